@@ -0,0 +1,426 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "geometry.h"
+#include "tri_simd.h"
+#include "primitives.h"
+#include "model.h"
+
+extern const float INF;
+extern int WIDTH;
+extern int HEIGHT;
+extern int recursion_depth;
+extern std::string SCENES_DIR;
+bool build_scene(const std::string &, Camera &);
+bool ClosestIntersection(Point &, Vector &, float, float, Point &, Vector &, Material &, uint32_t *);
+std::pair<float, float> ComputeLighting(Point &, Vector &, Vector &, int, float);
+Radiance TraceRay(Point &, Vector &, float, float, int);
+
+
+// Fixed seed so every run and every kernel sees the same rays and primitives.
+static std::mt19937 rng(12345);
+
+static float uniform(float lo, float hi)
+{
+    return std::uniform_real_distribution<float>(lo, hi)(rng);
+}
+
+static Point random_point(float r)
+{
+    return Point(uniform(-r, r), uniform(-r, r), uniform(-r, r));
+}
+
+
+struct Ray
+{
+    Point O;
+    Vector D;
+};
+
+// Rays from a shell around the origin aimed at random points inside it.
+static std::vector<Ray> random_rays(int n)
+{
+    std::vector<Ray> rays(n);
+    for (Ray &r : rays) {
+        r.O = random_point(1.f) + Point(0, 0, -4);
+        r.D = random_point(1.f) - r.O;
+    }
+    return rays;
+}
+
+
+// unit names what one op is, "op" for a ray against one primitive, "ray" for a whole ray. The
+// checksum is there to compare kernels of a section and to keep the work from being optimized away.
+static void report(const std::string &name, double seconds, double ops, long checksum, const char *unit = "op")
+{
+    std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(10) << seconds * 1e9 / ops << " ns/" << unit << std::setw(12) << ops / seconds * 1e-6 << " M" << unit
+              << "s/s   (check " << checksum << ")" << std::endl;
+}
+
+template<class F>
+static double timed(F f)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// One ray against every triangle, scalar per-triangle code vs. the packet kernels.
+static void bench_triangles(int ntris, int nrays)
+{
+    std::vector<Triangle> tris;
+    std::vector<TriPacket> packets((ntris + TRI_PACKET_WIDTH - 1) / TRI_PACKET_WIDTH);
+    for (int i = 0; i < ntris; ++i) {
+        Point v0 = random_point(1.f);
+        Point v1 = v0 + random_point(0.2f), v2 = v0 + random_point(0.2f);
+        tris.push_back(Triangle(v0, v1, v2, Material()));
+
+        TriPacket &p = packets[i / TRI_PACKET_WIDTH];
+        int lane = i % TRI_PACKET_WIDTH;
+        Vector e1 = v1 - v0, e2 = v2 - v0;
+        p.v0x[lane] = v0.x; p.v0y[lane] = v0.y; p.v0z[lane] = v0.z;
+        p.e1x[lane] = e1.x; p.e1y[lane] = e1.y; p.e1z[lane] = e1.z;
+        p.e2x[lane] = e2.x; p.e2y[lane] = e2.y; p.e2z[lane] = e2.z;
+    }
+    std::vector<Ray> rays = random_rays(nrays);
+    double ops = (double)ntris * nrays;
+
+    // hits counts (ray, group of TRI_PACKET_WIDTH triangles) pairs with any hit, the same for every kernel
+    long hits = 0;
+    double s = timed([&]() {
+        for (Ray &r : rays)
+            for (int i = 0; i < ntris; i += TRI_PACKET_WIDTH) {
+                bool any = false;
+                for (int j = i; j < std::min(ntris, i + TRI_PACKET_WIDTH); ++j) {
+                    float d = tris[j].IntersectRay(r.O, r.D).first;
+                    any = (d > 1e-5f && d < INF) || any;
+                }
+                hits += any;
+            }
+    });
+    report("Triangle::IntersectRay", s, ops, hits);
+
+    const char *names[] = {"scalar", "sse", "avx2"};
+    for (const char *name : names) {
+        TriPacketKernel kernel = find_tri_kernel(name);
+        if (!kernel) {
+            std::cout << std::left << std::setw(28) << (std::string("tri_packet_") + name) << "unsupported on this CPU" << std::endl;
+            continue;
+        }
+        hits = 0;
+        s = timed([&]() {
+            for (Ray &r : rays)
+                for (size_t k = 0; k < packets.size(); ++k) {
+                    int end = std::min(TRI_PACKET_WIDTH, ntris - (int)k * TRI_PACKET_WIDTH);
+                    float t_max = INF;
+                    hits += kernel(packets[k], r.O, r.D, 0, end, t_max) >= 0;
+                }
+        });
+        report(std::string("tri_packet_") + name, s, ops, hits);
+    }
+}
+
+
+// One ray against every sphere, the pair-returning scalar kernel vs. the nearest-root packet kernels.
+static void bench_spheres(int nspheres, int nrays)
+{
+    std::vector<SpherePrim> spheres;
+    std::vector<SpherePacket> packets((nspheres + SPHERE_PACKET_WIDTH - 1) / SPHERE_PACKET_WIDTH);
+    for (int i = 0; i < nspheres; ++i) {
+        Point c = random_point(1.f);
+        float r = uniform(0.01f, 0.1f);
+        SpherePrim s = {c.x, c.y, c.z, r, 0};
+        spheres.push_back(s);
+
+        SpherePacket &p = packets[i / SPHERE_PACKET_WIDTH];
+        int lane = i % SPHERE_PACKET_WIDTH;
+        p.cx[lane] = c.x; p.cy[lane] = c.y; p.cz[lane] = c.z;
+        p.r2[lane] = r * r;
+    }
+    std::vector<Ray> rays = random_rays(nrays);
+    double ops = (double)nspheres * nrays;
+
+    // hits counts (ray, group of SPHERE_PACKET_WIDTH spheres) pairs with any hit past t = 1
+    long hits = 0;
+    double s = timed([&]() {
+        for (Ray &r : rays)
+            for (int i = 0; i < nspheres; i += SPHERE_PACKET_WIDTH) {
+                bool any = false;
+                for (int j = i; j < std::min(nspheres, i + SPHERE_PACKET_WIDTH); ++j) {
+                    std::pair<float, float> t = spheres[j].IntersectRay(r.O, r.D);
+                    any = (t.first >= 1 && t.first < INF) || (t.second >= 1 && t.second < INF) || any;
+                }
+                hits += any;
+            }
+    });
+    report("SpherePrim::IntersectRay", s, ops, hits);
+
+    const char *names[] = {"scalar", "sse", "avx2"};
+    for (const char *name : names) {
+        SpherePacketKernel kernel = find_sphere_kernel(name);
+        if (!kernel) {
+            std::cout << std::left << std::setw(28) << (std::string("sphere_packet_") + name) << "unsupported on this CPU" << std::endl;
+            continue;
+        }
+        hits = 0;
+        s = timed([&]() {
+            for (Ray &r : rays)
+                for (size_t k = 0; k < packets.size(); ++k) {
+                    int end = std::min(SPHERE_PACKET_WIDTH, nspheres - (int)k * SPHERE_PACKET_WIDTH);
+                    float t_max = INF;
+                    hits += kernel(packets[k], r.O, r.D, 0, end, 1, t_max) >= 0;
+                }
+        });
+        report(std::string("sphere_packet_") + name, s, ops, hits);
+    }
+}
+
+
+// One ray against every sphere and every plane through the scene's Object classes.
+static void bench_objects(int nprims, int nrays)
+{
+    std::vector<Sphere> spheres;
+    std::vector<Plane> planes;
+    for (int i = 0; i < nprims; ++i) {
+        spheres.push_back(Sphere(random_point(1.f), uniform(0.01f, 0.1f), Material()));
+        Vector N = random_point(1.f) - Point(0, 0, 0);
+        planes.push_back(Plane(N / N.norm(), random_point(1.f), Material(), Material()));
+    }
+    std::vector<Ray> rays = random_rays(nrays);
+    double ops = (double)nprims * nrays;
+
+    // hits counts (ray, object) pairs hit past t = 1
+    long hits = 0;
+    double s = timed([&]() {
+        for (Ray &r : rays)
+            for (Sphere &sphere : spheres) {
+                std::pair<float, float> t = sphere.IntersectRay(r.O, r.D);
+                hits += (t.first >= 1 && t.first < INF) || (t.second >= 1 && t.second < INF);
+            }
+    });
+    report("Sphere::IntersectRay", s, ops, hits);
+
+    hits = 0;
+    s = timed([&]() {
+        for (Ray &r : rays)
+            for (Plane &plane : planes) {
+                float t = plane.IntersectRay(r.O, r.D).first;
+                hits += t >= 1 && t < INF;
+            }
+    });
+    report("Plane::IntersectRay", s, ops, hits);
+}
+
+
+// Rays at a model from a shell around its box, each against every face and through the BVH.
+// Returns false when the two disagree on which rays hit the model.
+static bool bench_model(const char *file, int nrays)
+{
+    Model model(file);
+    Point lo, hi;
+    model.get_bbox(lo, hi);
+    Point center((lo.x + hi.x) / 2, (lo.y + hi.y) / 2, (lo.z + hi.z) / 2);
+    float radius = (hi - lo).norm();
+
+    std::vector<Ray> rays(nrays);
+    for (Ray &r : rays) {
+        Vector out = random_point(1.f) - Point(0, 0, 0);
+        out = out * (radius / out.norm());
+        r.O = center + Point(out.x, out.y, out.z);
+        r.D = Point(uniform(lo.x, hi.x), uniform(lo.y, hi.y), uniform(lo.z, hi.z)) - r.O;
+    }
+    int nfaces = model.nfaces(), nslots = (int)model.bvh.prims.size();
+
+    // hits counts the rays hitting anything, the same for both. ray_triangle_intersect takes
+    // a slot of the leaf-ordered records, every face has one and padding slots are -1.
+    long hits = 0;
+    double s = timed([&]() {
+        for (Ray &r : rays) {
+            bool any = false;
+            for (int i = 0; i < nslots; ++i) {
+                float t;
+                any = (model.bvh.prims[i] >= 0 && model.ray_triangle_intersect(i, r.O, r.D, t)) || any;
+            }
+            hits += any;
+        }
+    });
+    report("Model::ray_triangle_intersect", s, (double)nfaces * nrays, hits);
+
+    long brute_hits = hits;
+    hits = 0;
+    s = timed([&]() {
+        for (Ray &r : rays) {
+            float t_max = INF;
+            int tri;
+            hits += model.intersect(r.O, r.D, t_max, tri);
+        }
+    });
+    report("Model::intersect (BVH)", s, nrays, hits, "ray");
+    if (hits != brute_hits)
+        std::cout << "Error: the BVH hits " << hits << " rays, testing every face hits " << brute_hits << std::endl;
+    return hits == brute_hits;
+}
+
+
+// Primary rays of a w x h frame from a camera at O looking along +z.
+static std::vector<Ray> camera_rays(const Point &O, float fov, int w, int h)
+{
+    std::vector<Ray> rays;
+    float scale = 2 * tan(fov * 3.1415926535f / 180 / 2) / w;
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x)
+            rays.push_back(Ray{O, Vector((x - w/2) * scale, (y - h/2) * scale, 1)});
+    return rays;
+}
+
+// Closest hit per ray through virtual Object calls vs. the type-sorted primitive store,
+// both scanning every primitive (the store visits its sphere leaves in turn, whole padded
+// packets). Optimized, the store is about twice as fast on scenes 1 and 2; without
+// optimization its kernels are not inlined and it is the slower one.
+static void bench_scene(const std::vector<Object*> &objects, const std::vector<Ray> &rays)
+{
+    PrimitiveStore store;
+    store.build(objects);
+    double ops = (double)rays.size();
+
+    long hits = 0;
+    double s = timed([&]() {
+        for (const Ray &r : rays) {
+            Point O = r.O;
+            Vector D = r.D;
+            float t_max = INF;
+            for (Object *obj : objects) {
+                std::pair<float, float> t = obj->IntersectRay(O, D);
+                t_max = std::min(t_max, t.first > 1 ? t.first : INF);
+                t_max = std::min(t_max, t.second > 1 ? t.second : INF);
+            }
+            hits += t_max < INF;
+        }
+    });
+    report("Object virtual, all", s, ops, hits);
+
+    hits = 0;
+    s = timed([&]() {
+        for (const Ray &r : rays) {
+            float t_max = INF;
+            for (const BVHNode &n : store.sphere_bvh.nodes)
+                if (n.count)
+                    store.intersect_spheres(n.first, n.count, r.O, r.D, 1, t_max);
+            for (size_t i = 0; i < store.planes.size(); ++i) {
+                std::pair<float, float> t = store.planes[i].IntersectRay(r.O, r.D);
+                t_max = std::min(t_max, t.first > 1 ? t.first : INF);
+            }
+            for (size_t i = 0; i < store.triangles.size(); ++i) {
+                std::pair<float, float> t = store.triangles[i].IntersectRay(r.O, r.D);
+                t_max = std::min(t_max, t.first > 1 ? t.first : INF);
+            }
+            hits += t_max < INF;
+        }
+    });
+    report("PrimitiveStore, all", s, ops, hits);
+}
+
+
+// Lighting at the primary hits of a scene file and whole primary rays, shading and secondary
+// rays included, at the width and height set in WIDTH and HEIGHT, on one thread.
+static void bench_shading(const std::string &path)
+{
+    Camera camera(Point(0, 0, 0), Vector(0, 0, 1), 60);
+    if (!build_scene(path, camera))
+        return;
+    std::vector<Ray> rays;
+    for (int y = 0; y < HEIGHT; ++y)
+        for (int x = 0; x < WIDTH; ++x)
+            rays.push_back(Ray{camera.O, camera.point_to_vector(y - HEIGHT/2, x - WIDTH/2)});
+
+    struct Hit
+    {
+        Point P;
+        Vector N, V;
+        Material mat;
+    };
+    std::vector<Hit> hits;
+    for (Ray &r : rays) {
+        Hit h;
+        if (ClosestIntersection(r.O, r.D, 1, INF, h.P, h.N, h.mat, NULL)) {
+            h.V = r.D * -1.f;
+            hits.push_back(h);
+        }
+    }
+
+    // the checks are the summed lighting and pixel values, truncated
+    double sum = 0;
+    double s = timed([&]() {
+        for (Hit &h : hits) {
+            std::pair<float, float> l = ComputeLighting(h.P, h.N, h.V, h.mat.specular, h.mat.specular_index);
+            sum += l.first + l.second;
+        }
+    });
+    report("ComputeLighting", s, hits.size(), (long)sum, "hit");
+
+    sum = 0;
+    s = timed([&]() {
+        for (Ray &r : rays) {
+            Radiance L = TraceRay(r.O, r.D, 1, INF, recursion_depth);
+            sum += L.r + L.g + L.b;
+        }
+    });
+    report("TraceRay", s, rays.size(), (long)sum, "ray");
+}
+
+
+int main()
+{
+#if defined(__GNUC__) && !defined(__OPTIMIZE__)
+    std::cout << "Warning: rt_bench is built without optimization, the SIMD kernels will look slow" << std::endl << std::endl;
+#endif
+    std::cout << "Triangles (4096 triangles x 2048 rays)" << std::endl;
+    bench_triangles(4096, 2048);
+
+    std::cout << std::endl << "Spheres (4096 spheres x 2048 rays)" << std::endl;
+    bench_spheres(4096, 2048);
+
+    // Geometry of scenes 1 and 2 (materials do not matter here), rays at 800x450.
+    std::cout << std::endl << "Scene 1 primary rays (6 spheres)" << std::endl;
+    Sphere env(Point(0, 0, 0), 100, Material());
+    Sphere s1(Point(0, 0, 17), 4, Material()), s2(Point(-10, -11, 17), 10, Material()), s3(Point(-10, 10, 34), 16, Material());
+    Sphere s4(Point(15, 10, 31), 15, Material()), s5(Point(5, -5, 11), 3, Material());
+    std::vector<Object*> scene1 = {&env, &s1, &s2, &s3, &s4, &s5};
+    bench_scene(scene1, camera_rays(Point(0, 0, -7), 60, 800, 450));
+
+    std::cout << std::endl << "Scene 2 primary rays (2 spheres, 6 planes, 6 triangles)" << std::endl;
+    Sphere t1(Point(6, -2, 12), 5, Material()), t2(Point(-8, -4, 17), 3, Material());
+    Plane p1(Vector(0, 0, -1), Point(0, 0, 20), Material(), Material()), p2(Vector(-1, 0, 0), Point(11, 0, 0), Material(), Material());
+    Plane p3(Vector(0, -1, 0), Point(0, 7, 0), Material(), Material()), p4(Vector(1, 0, 0), Point(-11, 0, 0), Material(), Material());
+    Plane p5(Vector(0, 1, 0), Point(0, -7, 0), Material(), Material()), p6(Vector(0, 0, 1), Point(0, 0, -11), Material(), Material());
+    Triangle r1(Point(-2, -7, 8), Point(-3, -1, 12), Point(0, -7, 13), Material());
+    Triangle r2(Point(-2, -7, 8), Point(-3, -1, 12), Point(-6, -7, 10), Material());
+    Triangle r3(Point(-6, -7, 10), Point(-3, -1, 12), Point(0, -7, 13), Material());
+    Triangle r4(Point(-3, -1, 12), Point(-2, -7, 8), Point(0, -7, 13), Material());
+    Triangle r5(Point(-3, -1, 12), Point(-2, -7, 8), Point(-6, -7, 10), Material());
+    Triangle r6(Point(-3, -1, 12), Point(-6, -7, 10), Point(0, -7, 13), Material());
+    std::vector<Object*> scene2 = {&t1, &t2, &p1, &p2, &p3, &p4, &p5, &p6, &r1, &r2, &r3, &r4, &r5, &r6};
+    bench_scene(scene2, camera_rays(Point(0, 0, -10), 70, 800, 450));
+
+    std::cout << std::endl << "Spheres and planes (1024 objects x 2048 rays)" << std::endl;
+    bench_objects(1024, 2048);
+
+    std::cout << std::endl << "Mesh rocket.obj (256 rays)" << std::endl;
+    bool ok = bench_model("rocket.obj", 256);
+
+    // Whole scenes at 400x225, primary rays only; secondary rays are part of TraceRay's time.
+    WIDTH = 400;
+    HEIGHT = 225;
+    for (int n = 1; n <= 3; ++n) {
+        std::cout << std::endl << "Scene " << n << " shading" << std::endl;
+        bench_shading(SCENES_DIR + "scene" + std::to_string(n) + ".scene");
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,298 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <sstream>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "geometry.h"
+#include "Bitmap.h"
+#include "stats.h"
+
+extern int WIDTH;
+extern int HEIGHT;
+extern int threads;
+extern std::string SCENES_DIR;
+bool build_scene(const std::string &, Camera &);
+void render(std::vector<uint32_t> &, std::vector<Radiance> &, std::vector<uint32_t> &, Camera &);
+
+// Reference renders, one per scene at the benchmark resolution, made with -update.
+static const std::string GOLDEN_DIR("../bench/golden/");
+static const int BENCH_WIDTH = 256, BENCH_HEIGHT = 144;
+// A render matches its reference when at most this share of its pixels differ by more than
+// the tolerance in some channel; a little slack for SIMD kernels rounding differently.
+static const float MAX_BAD_PIXELS = 0.001f;
+// Renders per case, the fastest one is reported.
+static const int REPEATS = 3;
+
+
+// Fixed seed, the stress scenes are the same on every run. The mt19937 sequence is fixed by the
+// standard, unlike std::uniform_real_distribution, so the scenes match across standard libraries.
+static std::mt19937 rng(12345);
+
+static float uniform(float lo, float hi)
+{
+    return lo + (hi - lo) * (float)(rng() / 4294967296.0);
+}
+
+static const char *STRESS_MATERIALS =
+    "#        name    r   g   b   specular specular_index reflective refractive_index refractive\n"
+    "material matte   180 180 170 -1       0              0          0                1\n"
+    "material red     200 20  0   2        0.1            0.04       0                1\n"
+    "material mirror  100 100 100 800      2              0.8        0                1\n"
+    "material glass   200 200 200 200      0.8            0.2        0.8              4\n"
+    "light point 0.6 15 20 -10\n"
+    "light point 0.3 -20 10 -5\n"
+    "light ambient 0.1\n"
+    "background 15 0 35\n"
+    "camera 0 0 -30 0 0 1 60\n";
+
+// Many small spheres of every material in a box in front of the camera.
+static bool WriteSphereScene(const std::string &path, int count)
+{
+    const char *materials[] = {"matte", "red", "mirror", "glass"};
+    std::ofstream out(path);
+    out << "# " << count << " random spheres, written by rt_scenebench\n" << STRESS_MATERIALS;
+    for(int i = 0; i < count; ++i)
+        out << "sphere " << uniform(-15, 15) << " " << uniform(-9, 9) << " " << uniform(0, 20) << " " << uniform(0.2f, 1.2f)
+            << " " << materials[i % 4] << "\n";
+    out.close();
+    return !out.fail();
+}
+
+// Many small opaque triangles over a reflecting floor.
+static bool WriteTriangleScene(const std::string &path, int count)
+{
+    const char *materials[] = {"matte", "red", "mirror"};
+    std::ofstream out(path);
+    out << "# " << count << " random triangles, written by rt_scenebench\n" << STRESS_MATERIALS
+        << "plane 0 1 0 0 -10 0 mirror matte\n";
+    for(int i = 0; i < count; ++i)
+    {
+        float x = uniform(-15, 15), y = uniform(-9, 9), z = uniform(0, 20);
+        out << "triangle";
+        for(int k = 0; k < 3; ++k)
+            out << " " << x + uniform(-1.5f, 1.5f) << " " << y + uniform(-1.5f, 1.5f) << " " << z + uniform(-1.5f, 1.5f);
+        out << " " << materials[i % 3] << "\n";
+    }
+    out.close();
+    return !out.fail();
+}
+
+
+// Pixels of a and b, BMP files of the same size, that differ by more than tolerance in a
+// channel; -1 when they do not have the same size.
+static long CountBadPixels(const std::string &a, const std::string &b, int tolerance)
+{
+    std::ifstream fa(a, std::ios::binary), fb(b, std::ios::binary);
+    std::vector<char> da((std::istreambuf_iterator<char>(fa)), std::istreambuf_iterator<char>());
+    std::vector<char> db((std::istreambuf_iterator<char>(fb)), std::istreambuf_iterator<char>());
+    if(da.size() != db.size() || da.size() < 54 || memcmp(da.data(), db.data(), 54) != 0)
+        return -1;
+
+    long bad = 0;
+    int row = BENCH_WIDTH * 3, padded = (row + 3) & ~3;
+    for(int y = 0; y < BENCH_HEIGHT; ++y)
+        for(int x = 0; x < row; x += 3)
+        {
+            const unsigned char *pa = (const unsigned char *)&da[54 + y * padded + x];
+            const unsigned char *pb = (const unsigned char *)&db[54 + y * padded + x];
+            bool differs = false;
+            for(int c = 0; c < 3; ++c)
+                differs = abs(pa[c] - pb[c]) > tolerance || differs;
+            bad += differs;
+        }
+    return bad;
+}
+
+// Peak resident memory of this process; in a case's child process that is the case's own peak.
+static double PeakMemoryMB()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0; // KB on Linux
+}
+
+
+struct Result
+{
+    std::string name;
+    int threads;
+    double setup, render, mrays, peak_mb;
+    std::string check;
+};
+
+// Renders scene with the given threads into <name>.bmp and compares it with the reference,
+// or makes it the reference when updating. Returns false on a failed check.
+static bool RunCase(const std::string &name, const std::string &scene, int nthreads, bool update, int tolerance,
+                    std::vector<Result> &results)
+{
+    Result r = Result();
+    r.name = name;
+    r.threads = nthreads;
+    stats = RenderStats();
+    threads = nthreads;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Camera camera(Point(0, 0, 0), Vector(0, 0, 1), 60);
+    if(!build_scene(scene, camera))
+    {
+        r.check = "scene failed";
+        results.push_back(r);
+        return false;
+    }
+    r.setup = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<uint32_t> image(WIDTH * HEIGHT), cost;
+    std::vector<Radiance> hdr;
+    for(int k = 0; k < REPEATS; ++k)
+    {
+        stats = RenderStats();
+        render(image, hdr, cost, camera);
+        if(k == 0 || stats.render < r.render)
+        {
+            r.render = stats.render;
+            r.mrays = stats.mrays_per_s();
+        }
+    }
+    r.peak_mb = PeakMemoryMB();
+
+    std::string out = name + ".bmp", golden = GOLDEN_DIR + name + ".bmp";
+    SaveBMP(out.c_str(), image.data(), WIDTH, HEIGHT);
+    if(update)
+        SaveBMP(golden.c_str(), image.data(), WIDTH, HEIGHT);
+    long bad = CountBadPixels(out, golden, tolerance);
+    bool ok = bad >= 0 && bad <= MAX_BAD_PIXELS * WIDTH * HEIGHT;
+    if(bad < 0)
+        r.check = update ? "FAILED, can not write " + golden : "FAILED, no reference " + golden;
+    else
+        r.check = (ok ? (update ? "updated" : "ok") : "FAILED") + std::string(", ") + std::to_string(bad) + " pixels off";
+    results.push_back(r);
+    return ok;
+}
+
+
+// Runs RunCase in a child process, so that the peak memory it reports belongs to this case
+// alone and not to every scene loaded before it. The child sends its result back over a pipe.
+static bool RunIsolated(const std::string &name, const std::string &scene, int nthreads, bool update, int tolerance,
+                        std::vector<Result> &results)
+{
+    int fds[2];
+    std::cout.flush();
+    if(pipe(fds) != 0)
+        return RunCase(name, scene, nthreads, update, tolerance, results);
+    pid_t pid = fork();
+    if(pid < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return RunCase(name, scene, nthreads, update, tolerance, results);
+    }
+    if(pid == 0)
+    {
+        close(fds[0]);
+        std::vector<Result> own;
+        bool ok = RunCase(name, scene, nthreads, update, tolerance, own);
+        std::ostringstream out;
+        out.precision(17);
+        out << ok << " " << own[0].setup << " " << own[0].render << " " << own[0].mrays << " " << own[0].peak_mb << "\n"
+            << own[0].check;
+        std::string text = out.str();
+        bool sent = write(fds[1], text.data(), text.size()) == (ssize_t)text.size();
+        std::cout.flush();
+        _exit(sent ? 0 : 1);
+    }
+    close(fds[1]);
+    std::string text;
+    char buffer[256];
+    for(ssize_t n; (n = read(fds[0], buffer, sizeof(buffer))) > 0; )
+        text.append(buffer, n);
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+
+    Result r = Result();
+    r.name = name;
+    r.threads = nthreads;
+    std::istringstream in(text);
+    bool ok = false;
+    if(!(in >> ok >> r.setup >> r.render >> r.mrays >> r.peak_mb) || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        r = Result();
+        r.name = name;
+        r.threads = nthreads;
+        r.check = "FAILED, the case did not finish";
+        ok = false;
+    }
+    else
+    {
+        in.ignore(1);
+        std::getline(in, r.check, '\0');
+    }
+    results.push_back(r);
+    return ok;
+}
+
+
+// End-to-end renders of scenes 1-3, the rocket crowd, the empty-sky horizon and two generated
+// stress scenes at a fixed size, each on one thread and on four, checked against reference
+// images. Run from the build directory; -update rewrites the references, -tolerance sets the
+// allowed per-channel difference.
+int main(int argc, const char** argv)
+{
+    bool update = false;
+    int tolerance = 8;
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg == "-update")
+            update = true;
+        else if(arg == "-tolerance" && i + 1 < argc)
+            tolerance = atoi(argv[++i]);
+        else
+        {
+            std::cerr << "Usage: rt_scenebench [-update] [-tolerance <levels>]" << std::endl;
+            return 1;
+        }
+    }
+
+    WIDTH = BENCH_WIDTH;
+    HEIGHT = BENCH_HEIGHT;
+    std::vector<std::pair<std::string, std::string> > scenes;
+    for(int n = 1; n <= 3; ++n)
+        scenes.push_back(std::make_pair("scene" + std::to_string(n), SCENES_DIR + "scene" + std::to_string(n) + ".scene"));
+    scenes.push_back(std::make_pair("rockets", SCENES_DIR + "rockets.scene"));
+    scenes.push_back(std::make_pair("horizon", SCENES_DIR + "horizon.scene"));
+    if(!WriteSphereScene("stress_spheres.scene", 2000) || !WriteTriangleScene("stress_triangles.scene", 5000))
+    {
+        std::cerr << "Error: can not write the stress scenes" << std::endl;
+        return 1;
+    }
+    scenes.push_back(std::make_pair("stress_spheres", "stress_spheres.scene"));
+    scenes.push_back(std::make_pair("stress_triangles", "stress_triangles.scene"));
+
+    const int thread_counts[] = {1, 4};
+    std::vector<Result> results;
+    bool ok = true;
+    for(size_t i = 0; i < scenes.size(); ++i)
+        for(int t : thread_counts)
+            ok = RunIsolated(scenes[i].first, scenes[i].second, t, update && t == thread_counts[0], tolerance, results) && ok;
+
+    std::cout << std::endl << "Scenes at " << BENCH_WIDTH << "x" << BENCH_HEIGHT << ", tolerance " << tolerance
+              << ", every run in its own process" << std::endl;
+    std::cout << std::left << std::setw(18) << "scene" << std::right << std::setw(8) << "threads" << std::setw(10) << "setup s"
+              << std::setw(10) << "render s" << std::setw(10) << "Mrays/s" << std::setw(10) << "peak MB" << "   check" << std::endl;
+    for(const Result &r : results)
+        std::cout << std::left << std::setw(18) << r.name << std::right << std::setw(8) << r.threads << std::fixed
+                  << std::setprecision(3) << std::setw(10) << r.setup << std::setw(10) << r.render << std::setprecision(2)
+                  << std::setw(10) << r.mrays << std::setprecision(1) << std::setw(10) << r.peak_mb << "   " << r.check
+                  << std::endl;
+    return ok ? 0 : 1;
+}
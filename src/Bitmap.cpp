@@ -1,12 +1,17 @@
 #include <vector>
 #include <fstream>
 #include <cstring>
+#include <cmath>
+#include <string>
+#include <algorithm>
 
 struct Pixel { unsigned char r, g, b; };
 
 void WriteBMP(const char* fname, Pixel* a_pixelData, int width, int height)
 {
-    int paddedsize = (width*height) * sizeof(Pixel);
+    int rowsize    = width * sizeof(Pixel);
+    int rowpadding = (4 - rowsize % 4) % 4; // rows are stored 4-byte aligned
+    int paddedsize = (rowsize + rowpadding) * height;
 
     unsigned char bmpfileheader[14] = {'B','M', 0,0,0,0, 0,0, 0,0, 54,0,0,0};
     unsigned char bmpinfoheader[40] = {40,0,0,0, 0,0,0,0, 0,0,0,0, 1,0, 24,0};
@@ -28,7 +33,12 @@ void WriteBMP(const char* fname, Pixel* a_pixelData, int width, int height)
     std::ofstream out(fname, std::ios::out | std::ios::binary);
     out.write((const char*)bmpfileheader, 14);
     out.write((const char*)bmpinfoheader, 40);
-    out.write((const char*)a_pixelData, paddedsize);
+    const char padding[3] = {0, 0, 0};
+    for (int y = 0; y < height; y++)
+    {
+        out.write((const char*)(a_pixelData + y*width), rowsize);
+        out.write(padding, rowpadding);
+    }
     out.flush();
     out.close();
 }
@@ -47,4 +57,59 @@ void SaveBMP(const char* fname, const unsigned int* pixels, int w, int h)
     }
 
     WriteBMP(fname, &pixels2[0], w, h);
-}
\ No newline at end of file
+}
+
+void SaveHDR(const char* fname, const float* pixels, int channels, int w, int h, float scale)
+{
+    std::ofstream out(fname, std::ios::out | std::ios::binary);
+    std::string header = "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " + std::to_string(h) + " +X " + std::to_string(w) + "\n";
+    out.write(header.data(), header.size());
+
+    // -Y lists rows top to bottom, flat (uncompressed) scanlines of shared-exponent RGBE
+    std::vector<unsigned char> row(4 * w);
+    for (int y = h - 1; y >= 0; y--)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            const float *p = pixels + (size_t)(y*w + x) * channels;
+            float r = std::max(0.f, p[0] * scale), g = std::max(0.f, p[1] * scale), b = std::max(0.f, p[2] * scale);
+            float v = std::max(r, std::max(g, b));
+            unsigned char *e = &row[4 * x];
+            if (v < 1e-32f)
+            {
+                e[0] = e[1] = e[2] = e[3] = 0;
+                continue;
+            }
+            int exponent;
+            float m = frexpf(v, &exponent) * 256.f / v;
+            e[0] = (unsigned char)(r * m);
+            e[1] = (unsigned char)(g * m);
+            e[2] = (unsigned char)(b * m);
+            e[3] = (unsigned char)(exponent + 128);
+        }
+        out.write((const char*)row.data(), row.size());
+    }
+    out.flush();
+    out.close();
+}
+
+
+void SaveHeatmap(const char* fname, const unsigned int* values, int w, int h)
+{
+    static const float ramp[6][3] = {{0, 0, 0}, {0, 0, 1}, {0, 1, 1}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0}};
+    unsigned int top = *std::max_element(values, values + w * h);
+    float norm = top > 0 ? 1.f / logf(1.f + top) : 0.f;
+
+    std::vector<unsigned int> pixels(w * h);
+    for (int i = 0; i < w * h; i++)
+    {
+        float t = logf(1.f + values[i]) * norm * 5;
+        int k = std::min(4, (int)t);
+        float f = t - k;
+        unsigned int c = 0;
+        for (int j = 0; j < 3; j++)
+            c |= (unsigned int)(255.f * (ramp[k][j] + (ramp[k + 1][j] - ramp[k][j]) * f) + 0.5f) << (8 * j);
+        pixels[i] = c;
+    }
+    SaveBMP(fname, pixels.data(), w, h);
+}
@@ -3,4 +3,12 @@
 
 void SaveBMP(const char* fname, const unsigned int* pixels, int w, int h);
 
+// Radiance RGBE (.hdr) file from float RGB pixels, `channels` floats apart, bottom row first
+// like SaveBMP; every value is multiplied by scale.
+void SaveHDR(const char* fname, const float* pixels, int channels, int w, int h, float scale);
+
+// False color BMP of per-pixel values, black for 0 through blue, cyan, green and yellow to red
+// for the largest, on a log scale so the cheap pixels keep some contrast.
+void SaveHeatmap(const char* fname, const unsigned int* values, int w, int h);
+
 #endif 
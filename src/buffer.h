@@ -0,0 +1,67 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+
+// Read-only array that either owns its elements or views memory owned by
+// someone else (a mapped cache file), which `keep` holds alive.
+template<class T>
+class Buffer {
+private:
+    std::vector<T> owned;
+    const T *ptr;
+    size_t len;
+    std::shared_ptr<const void> keep;
+
+    void rebind(const T *p) {
+        ptr = keep ? p : owned.data();
+    }
+public:
+    Buffer() : ptr(NULL), len(0) {}
+    Buffer(std::vector<T> &&v) : owned(std::move(v)), ptr(owned.data()), len(owned.size()) {}
+    Buffer(const T *p, size_t n, const std::shared_ptr<const void> &k) : ptr(p), len(n), keep(k) {}
+    Buffer(const Buffer &b) : owned(b.owned), len(b.len), keep(b.keep) {
+        rebind(b.ptr);
+    }
+    Buffer(Buffer &&b) : owned(std::move(b.owned)), len(b.len), keep(std::move(b.keep)) {
+        rebind(b.ptr);
+    }
+    Buffer &operator=(const Buffer &b) {
+        owned = b.owned;
+        len = b.len;
+        keep = b.keep;
+        rebind(b.ptr);
+        return *this;
+    }
+    Buffer &operator=(Buffer &&b) {
+        owned = std::move(b.owned);
+        len = b.len;
+        keep = std::move(b.keep);
+        rebind(b.ptr);
+        return *this;
+    }
+
+    size_t size() const {
+        return len;
+    }
+    bool empty() const {
+        return len == 0;
+    }
+    const T *data() const {
+        return ptr;
+    }
+    const T &operator[](size_t i) const {
+        return ptr[i];
+    }
+    const T *begin() const {
+        return ptr;
+    }
+    const T *end() const {
+        return ptr + len;
+    }
+};
+
+#endif
@@ -0,0 +1,209 @@
+#include <cfloat>
+#include <chrono>
+#include "bvh.h"
+
+#define SAH_BINS 16
+#define SAH_TRAVERSAL_COST 1.f
+
+
+static float axis(const Point &P, int a)
+{
+    return a == 0 ? P.x : (a == 1 ? P.y : P.z);
+}
+
+
+// Primitive bounds kept in build order, so partitioning walks memory linearly.
+struct BuildPrim
+{
+    AABB box;
+    Point center;
+    int index;
+};
+
+
+
+AABB::AABB(): min(Point(FLT_MAX, FLT_MAX, FLT_MAX)), max(Point(-FLT_MAX, -FLT_MAX, -FLT_MAX)) {}
+AABB::AABB(const Point &mn, const Point &mx): min(mn), max(mx) {}
+Point AABB::center() const
+{
+    return Point((min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f, (min.z + max.z) * 0.5f);
+}
+float AABB::area() const
+{
+    if(min.x > max.x)
+        return 0.f;
+    Vector d = max - min;
+    return 2.f * (d.x*d.y + d.y*d.z + d.z*d.x);
+}
+
+
+
+BVH::BVH(): nodes(), prims(), build_ms(0), counters(BVH_COUNTER_SLOTS) {
+    reset_counters();
+}
+
+// intersect_cost is the price of one primitive test relative to a node visit.
+void BVH::build(const std::vector<AABB> &boxes, int max_leaf, float intersect_cost)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::vector<BVHNode> tree;
+    std::vector<BuildPrim> work(boxes.size());
+    for(size_t i = 0; i < boxes.size(); ++i)
+    {
+        work[i].box = boxes[i];
+        work[i].center = boxes[i].center();
+        work[i].index = (int)i;
+    }
+
+    if(!work.empty())
+    {
+        tree.reserve(2 * work.size());
+        build_node(tree, work.data(), 0, (int)work.size(), 0, max_leaf, intersect_cost);
+    }
+
+    std::vector<int> order(work.size());
+    for(size_t i = 0; i < work.size(); ++i)
+        order[i] = work[i].index;
+    nodes = Buffer<BVHNode>(std::move(tree));
+    prims = Buffer<int>(std::move(order));
+    reset_counters();
+
+    build_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int BVH::build_node(std::vector<BVHNode> &tree, BuildPrim *work, int begin, int end, int depth, int max_leaf, float intersect_cost)
+{
+    int index = (int)tree.size();
+    tree.push_back(BVHNode());
+
+    AABB box, centroid_box;
+    for(int i = begin; i < end; ++i)
+    {
+        box.grow(work[i].box);
+        centroid_box.grow(work[i].center);
+    }
+    tree[index].box = box;
+    tree[index].first = begin;
+    tree[index].count = end - begin;
+
+    int count = end - begin;
+    if(count <= 1 || depth >= BVH_MAX_DEPTH)
+        return index;
+
+    // Binned SAH: for every axis sweep the bin boundaries and keep the cheapest split.
+    float best_cost = FLT_MAX;
+    int best_axis = -1, best_bin = 0;
+    for(int a = 0; a < 3; ++a)
+    {
+        float lo = axis(centroid_box.min, a), hi = axis(centroid_box.max, a);
+        if(hi - lo <= 1e-12f)
+            continue;
+
+        AABB bin_box[SAH_BINS];
+        int bin_count[SAH_BINS] = {0};
+        float scale = SAH_BINS / (hi - lo);
+        for(int i = begin; i < end; ++i)
+        {
+            int b = std::min(SAH_BINS - 1, (int)((axis(work[i].center, a) - lo) * scale));
+            bin_count[b]++;
+            bin_box[b].grow(work[i].box);
+        }
+
+        float left_area[SAH_BINS - 1];
+        int left_count[SAH_BINS - 1];
+        AABB acc;
+        int n = 0;
+        for(int b = 0; b < SAH_BINS - 1; ++b)
+        {
+            acc.grow(bin_box[b]);
+            n += bin_count[b];
+            left_area[b] = acc.area();
+            left_count[b] = n;
+        }
+        acc = AABB();
+        n = 0;
+        for(int b = SAH_BINS - 1; b > 0; --b)
+        {
+            acc.grow(bin_box[b]);
+            n += bin_count[b];
+            float cost = left_area[b - 1] * left_count[b - 1] + acc.area() * n;
+            if(left_count[b - 1] && n && cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = a;
+                best_bin = b;
+            }
+        }
+    }
+
+    float leaf_cost = intersect_cost * box.area() * count;
+    float split_cost = SAH_TRAVERSAL_COST * box.area() + intersect_cost * best_cost;
+    if(count <= max_leaf && (best_axis == -1 || split_cost >= leaf_cost))
+        return index;
+
+    int mid;
+    if(best_axis != -1)
+    {
+        float lo = axis(centroid_box.min, best_axis);
+        float scale = SAH_BINS / (axis(centroid_box.max, best_axis) - lo);
+        mid = (int)(std::partition(work + begin, work + end, [&](const BuildPrim &p) {
+            return std::min(SAH_BINS - 1, (int)((axis(p.center, best_axis) - lo) * scale)) < best_bin;
+        }) - work);
+    }
+    else
+        mid = begin + count / 2; // all centroids coincide, split by count
+
+    build_node(tree, work, begin, mid, depth + 1, max_leaf, intersect_cost);
+    int right = build_node(tree, work, mid, end, depth + 1, max_leaf, intersect_cost);
+    tree[index].first = right;
+    tree[index].count = 0;
+    return index;
+}
+
+void BVH::pad_leaves(int width)
+{
+    std::vector<BVHNode> tree(nodes.begin(), nodes.end());
+    std::vector<int> order;
+    order.reserve(prims.size() + prims.size() / 2);
+    for(BVHNode &n : tree)
+    {
+        if(!n.count)
+            continue;
+        order.resize((order.size() + width - 1) / width * width, -1);
+        int first = (int)order.size();
+        order.insert(order.end(), prims.begin() + n.first, prims.begin() + n.first + n.count);
+        n.first = first;
+    }
+    order.resize((order.size() + width - 1) / width * width, -1);
+    nodes = Buffer<BVHNode>(std::move(tree));
+    prims = Buffer<int>(std::move(order));
+}
+
+int BVH::nnodes() const {
+    return (int)nodes.size();
+}
+
+float BVH::avg_visited() const
+{
+    uint64_t rays, visited, tested;
+    totals(rays, visited, tested);
+    return rays ? (float)visited / rays : 0.f;
+}
+
+void BVH::totals(uint64_t &rays, uint64_t &nodes, uint64_t &prims) const
+{
+    rays = nodes = prims = 0;
+    for(const BVHCounter &c : counters)
+    {
+        rays += c.rays;
+        nodes += c.nodes;
+        prims += c.prims;
+    }
+}
+
+void BVH::reset_counters()
+{
+    for(BVHCounter &c : counters)
+        c.rays = c.nodes = c.prims = 0;
+}
@@ -0,0 +1,399 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <omp.h>
+#include "geometry.h"
+#include "buffer.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define BVH_MAX_DEPTH 64
+#define BVH_COUNTER_SLOTS 256
+#define BVH_PACKET_MAX 64
+// A packet splits into single rays once no more than 1/BVH_PACKET_SPLIT of its lanes stay active.
+#define BVH_PACKET_SPLIT 4
+
+
+// Lowest set bit of a nonzero lane mask, and the number of set bits.
+inline int ctz64(uint64_t x)
+{
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return (int)i;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+inline int popcount64(uint64_t x)
+{
+#ifdef _MSC_VER
+    return (int)__popcnt64(x);
+#else
+    return __builtin_popcountll(x);
+#endif
+}
+
+// Rays traced together, in structure-of-arrays layout so every box test runs
+// the same arithmetic over all lanes. t_max is the per-lane far bound.
+struct RayPacket
+{
+    int size;
+    float ox[BVH_PACKET_MAX], oy[BVH_PACKET_MAX], oz[BVH_PACKET_MAX];
+    float dx[BVH_PACKET_MAX], dy[BVH_PACKET_MAX], dz[BVH_PACKET_MAX];
+    float ix[BVH_PACKET_MAX], iy[BVH_PACKET_MAX], iz[BVH_PACKET_MAX];
+    float t_max[BVH_PACKET_MAX];
+
+    RayPacket(): size(0) {}
+    void add(const Point &O, const Vector &D, float t)
+    {
+        ox[size] = O.x; oy[size] = O.y; oz[size] = O.z;
+        dx[size] = D.x; dy[size] = D.y; dz[size] = D.z;
+        ix[size] = 1.f / D.x; iy[size] = 1.f / D.y; iz[size] = 1.f / D.z;
+        t_max[size++] = t;
+    }
+    Point origin(int lane) const
+    {
+        return Point(ox[lane], oy[lane], oz[lane]);
+    }
+    Vector dir(int lane) const
+    {
+        return Vector(dx[lane], dy[lane], dz[lane]);
+    }
+    uint64_t lanes() const
+    {
+        return size == 64 ? ~(uint64_t)0 : ((uint64_t)1 << size) - 1;
+    }
+};
+
+
+struct AABB
+{
+    Point min;
+    Point max;
+
+    AABB();
+    AABB(const Point &mn, const Point &mx);
+    void grow(const Point &P)
+    {
+        min.x = std::min(min.x, P.x); min.y = std::min(min.y, P.y); min.z = std::min(min.z, P.z);
+        max.x = std::max(max.x, P.x); max.y = std::max(max.y, P.y); max.z = std::max(max.z, P.z);
+    }
+    void grow(const AABB &B)
+    {
+        min.x = std::min(min.x, B.min.x); min.y = std::min(min.y, B.min.y); min.z = std::min(min.z, B.min.z);
+        max.x = std::max(max.x, B.max.x); max.y = std::max(max.y, B.max.y); max.z = std::max(max.z, B.max.z);
+    }
+    Point center() const;
+    float area() const;
+
+    // Slab test, inv_D is the componentwise inverse of the ray direction.
+    bool IntersectRay(const Point &O, const Vector &inv_D, float t_min, float t_max, float &t_near) const
+    {
+        float t0 = (min.x - O.x) * inv_D.x, t1 = (max.x - O.x) * inv_D.x;
+        float lo = std::min(t0, t1), hi = std::max(t0, t1);
+        t0 = (min.y - O.y) * inv_D.y; t1 = (max.y - O.y) * inv_D.y;
+        lo = std::max(lo, std::min(t0, t1)); hi = std::min(hi, std::max(t0, t1));
+        t0 = (min.z - O.z) * inv_D.z; t1 = (max.z - O.z) * inv_D.z;
+        lo = std::max(lo, std::min(t0, t1)); hi = std::min(hi, std::max(t0, t1));
+        lo = std::max(lo, t_min);
+        hi = std::min(hi, t_max);
+        t_near = lo;
+        return lo <= hi;
+    }
+
+    // The same slab test for every lane of a packet, returns the mask of lanes that enter the box.
+    uint64_t IntersectPacket(const RayPacket &r, float t_min) const
+    {
+        int32_t hit[BVH_PACKET_MAX];
+        for(int i = 0; i < r.size; ++i)
+        {
+            float t0 = (min.x - r.ox[i]) * r.ix[i], t1 = (max.x - r.ox[i]) * r.ix[i];
+            float lo = std::min(t0, t1), hi = std::max(t0, t1);
+            t0 = (min.y - r.oy[i]) * r.iy[i]; t1 = (max.y - r.oy[i]) * r.iy[i];
+            lo = std::max(lo, std::min(t0, t1)); hi = std::min(hi, std::max(t0, t1));
+            t0 = (min.z - r.oz[i]) * r.iz[i]; t1 = (max.z - r.oz[i]) * r.iz[i];
+            lo = std::max(lo, std::min(t0, t1)); hi = std::min(hi, std::max(t0, t1));
+            lo = std::max(lo, t_min);
+            hi = std::min(hi, r.t_max[i]);
+            hit[i] = lo <= hi;
+        }
+        uint64_t mask = 0;
+        for(int i = 0; i < r.size; ++i)
+            mask |= (uint64_t)hit[i] << i;
+        return mask;
+    }
+};
+
+
+struct BVHNode
+{
+    AABB box;
+    int32_t first; // leaf: first index in BVH::prims, inner node: index of the right child
+    int32_t count; // leaf: number of primitives, inner node: 0 (left child is the next node)
+};
+
+
+// Per-thread traversal counters, padded to a cache line to avoid false sharing.
+struct BVHCounter
+{
+    uint64_t rays;
+    uint64_t nodes;
+    uint64_t prims; // primitives tested in the leaves reached
+    char pad[40];
+};
+
+
+class BVH {
+public:
+    Buffer<BVHNode> nodes;
+    Buffer<int> prims;
+    float build_ms;
+
+    BVH();
+    // Builds the hierarchy over primitive bounds with the binned surface area heuristic.
+    void build(const std::vector<AABB> &boxes, int max_leaf = 4, float intersect_cost = 1.f);
+    // Moves every leaf to a slot that is a multiple of width, filling the gaps with -1 in prims,
+    // so leaves line up with fixed-width primitive packets.
+    void pad_leaves(int width);
+
+    int nnodes() const;
+    float avg_visited() const;
+    // Counter totals over all threads since the last reset.
+    void totals(uint64_t &rays, uint64_t &nodes, uint64_t &prims) const;
+    void reset_counters();
+
+    // Visits leaves front to back, skipping nodes farther than the closest hit found so far.
+    // hit(first, count, t_min, t_max) tests the leaf's slots [first, first + count), shrinks t_max
+    // and returns true on a closer hit. Slots index prims, so callers that store their primitives
+    // in prims order read every leaf as one contiguous run.
+    template<class Hit>
+    bool traverse(const Point &O, const Vector &D, float t_min, float &t_max, Hit &hit) const
+    {
+        if(nodes.empty())
+            return false;
+        counter().rays++;
+        return walk<false>(O, D, t_min, t_max, hit, 0);
+    }
+
+    // Same walk, but returns as soon as hit() reports a leaf hit (shadow rays).
+    template<class Hit>
+    bool occluded(const Point &O, const Vector &D, float t_min, float t_max, Hit &hit) const
+    {
+        if(nodes.empty())
+            return false;
+        counter().rays++;
+        return walk<true>(O, D, t_min, t_max, hit, 0);
+    }
+
+    // Closest hits for a whole packet: every node is tested against all active lanes at once
+    // and the packet descends while enough lanes agree, then the remaining lanes finish the
+    // subtree one by one. hit(lane, first, count, t_min, t_max) is the per-lane leaf test,
+    // rays.t_max shrinks as hits are found. Returns the mask of lanes that hit something.
+    template<class Hit>
+    uint64_t traverse_packet(RayPacket &rays, float t_min, Hit &hit) const
+    {
+        if(nodes.empty() || !rays.size)
+            return 0;
+        BVHCounter &c = counter();
+        c.rays += rays.size;
+
+        struct Entry
+        {
+            int node;
+            uint64_t lanes;
+        } stack[BVH_MAX_DEPTH + 2];
+        int sp = 0;
+        uint64_t found = 0;
+        stack[sp++] = Entry{0, rays.lanes()};
+
+        while(sp)
+        {
+            Entry e = stack[--sp];
+            const BVHNode &n = nodes[e.node];
+            uint64_t active = n.box.IntersectPacket(rays, t_min) & e.lanes;
+            if(!active)
+                continue;
+
+            if(!n.count && popcount64(active) * BVH_PACKET_SPLIT <= rays.size)
+            {
+                for(uint64_t m = active; m; m &= m - 1)
+                {
+                    int lane = ctz64(m);
+                    LaneHit<Hit> lane_hit(hit, lane);
+                    if(walk<false>(rays.origin(lane), rays.dir(lane), t_min, rays.t_max[lane], lane_hit, e.node))
+                        found |= (uint64_t)1 << lane;
+                }
+                continue;
+            }
+
+            c.nodes++;
+            if(n.count)
+            {
+                c.prims += (uint64_t)n.count * popcount64(active);
+                for(uint64_t m = active; m; m &= m - 1)
+                {
+                    int lane = ctz64(m);
+                    if(hit(lane, n.first, n.count, t_min, rays.t_max[lane]))
+                        found |= (uint64_t)1 << lane;
+                }
+                continue;
+            }
+
+            // Visit first the child the first active ray reaches first.
+            int near = e.node + 1, far = n.first;
+            int lane = ctz64(active);
+            Point a = nodes[near].box.center(), b = nodes[far].box.center();
+            if((b.x - a.x) * rays.dx[lane] + (b.y - a.y) * rays.dy[lane] + (b.z - a.z) * rays.dz[lane] < 0)
+                std::swap(near, far);
+            stack[sp++] = Entry{far, active};
+            stack[sp++] = Entry{near, active};
+        }
+        return found;
+    }
+
+    // Packet walk that never splits into single rays: a leaf reached by any lane gets the
+    // mask of all of them, leaf(first, count, lanes, t_min) tests them together (an instance
+    // leaf runs a nested packet traversal), shrinks their t_max and returns the lanes that hit.
+    template<class Leaf>
+    uint64_t traverse_packet_leaves(RayPacket &rays, float t_min, Leaf &leaf) const
+    {
+        if(nodes.empty() || !rays.size)
+            return 0;
+        BVHCounter &c = counter();
+        c.rays += rays.size;
+
+        struct Entry
+        {
+            int node;
+            uint64_t lanes;
+        } stack[BVH_MAX_DEPTH + 2];
+        int sp = 0;
+        uint64_t found = 0;
+        stack[sp++] = Entry{0, rays.lanes()};
+
+        while(sp)
+        {
+            Entry e = stack[--sp];
+            const BVHNode &n = nodes[e.node];
+            uint64_t active = n.box.IntersectPacket(rays, t_min) & e.lanes;
+            if(!active)
+                continue;
+
+            c.nodes++;
+            if(n.count)
+            {
+                c.prims += (uint64_t)n.count * popcount64(active);
+                found |= leaf(n.first, n.count, active, t_min);
+                continue;
+            }
+
+            int near = e.node + 1, far = n.first;
+            int lane = ctz64(active);
+            Point a = nodes[near].box.center(), b = nodes[far].box.center();
+            if((b.x - a.x) * rays.dx[lane] + (b.y - a.y) * rays.dy[lane] + (b.z - a.z) * rays.dz[lane] < 0)
+                std::swap(near, far);
+            stack[sp++] = Entry{far, active};
+            stack[sp++] = Entry{near, active};
+        }
+        return found;
+    }
+
+private:
+    mutable std::vector<BVHCounter> counters;
+
+    BVHCounter &counter() const
+    {
+        return counters[omp_get_thread_num() % BVH_COUNTER_SLOTS];
+    }
+
+    // Adapts a packet leaf test to the single ray walk of one lane.
+    template<class Hit>
+    struct LaneHit
+    {
+        Hit &hit;
+        int lane;
+
+        LaneHit(Hit &h, int l): hit(h), lane(l) {}
+        bool operator()(int first, int count, float t_min, float &t_max)
+        {
+            return hit(lane, first, count, t_min, t_max);
+        }
+    };
+
+    // Walks the subtree under root.
+    template<bool any_hit, class Hit>
+    bool walk(const Point &O, const Vector &D, float t_min, float &t_max, Hit &hit, int root) const
+    {
+        BVHCounter &counter = this->counter();
+
+        Vector inv_D(1.f / D.x, 1.f / D.y, 1.f / D.z);
+        int stack[BVH_MAX_DEPTH + 1];
+        float stack_t[BVH_MAX_DEPTH + 1];
+        int sp = 0;
+        bool found = false;
+        float t_near, t_far;
+
+        if(!nodes[root].box.IntersectRay(O, inv_D, t_min, t_max, t_near))
+            return false;
+
+        int node = root;
+        for(;;)
+        {
+            const BVHNode &n = nodes[node];
+            counter.nodes++;
+            if(n.count)
+            {
+                counter.prims += n.count;
+                if(hit(n.first, n.count, t_min, t_max))
+                {
+                    if(any_hit)
+                        return true;
+                    found = true;
+                }
+            }
+            else
+            {
+                int near = node + 1, far = n.first;
+                bool hit_near = nodes[near].box.IntersectRay(O, inv_D, t_min, t_max, t_near);
+                bool hit_far = nodes[far].box.IntersectRay(O, inv_D, t_min, t_max, t_far);
+                if(hit_near && hit_far)
+                {
+                    if(t_far < t_near)
+                    {
+                        std::swap(near, far);
+                        std::swap(t_near, t_far);
+                    }
+                    stack[sp] = far;
+                    stack_t[sp++] = t_far;
+                    node = near;
+                    continue;
+                }
+                if(hit_near || hit_far)
+                {
+                    node = hit_near ? near : far;
+                    continue;
+                }
+            }
+
+            do
+            {
+                if(sp == 0)
+                    return found;
+                --sp;
+            }
+            while(stack_t[sp] > t_max);
+            node = stack[sp];
+        }
+    }
+
+    int build_node(std::vector<BVHNode> &tree, struct BuildPrim *work, int begin, int end, int depth, int max_leaf, float intersect_cost);
+};
+
+
+#endif
@@ -1,7 +1,7 @@
 #include "geometry.h"
 
-extern const int HEIGHT;
-extern const int WIDTH;
+extern int HEIGHT;
+extern int WIDTH;
 extern const float PI;
 extern const float INF;
 extern const float EPSILON;
@@ -27,22 +27,22 @@ Color Color::operator+(const Color &K){
 
 Vector::Vector(): x(0), y(0), z(0) {}   
 Vector::Vector(const float &x, const float &y, const float &z): x(x), y(y), z(z) {}
-float Vector::operator*(const Vector &B) {
+float Vector::operator*(const Vector &B) const {
     return x * B.x + y * B.y + z * B.z;
 }
-Vector Vector::operator+(const Vector &B) {
+Vector Vector::operator+(const Vector &B) const {
     return Vector(x + B.x, y + B.y, z + B.z);
 }
-Vector Vector::operator/(const float c){
+Vector Vector::operator/(const float c) const {
 	return Vector(x / c, y / c, z / c);
 }
-float Vector::norm() {
+float Vector::norm() const {
     return sqrtf(x*x + y*y + z*z);
 }
-Point Vector::to_point(float c) {
+Point Vector::to_point(float c) const {
     return Point(x*c, y*c, z*c);
 }
-Vector Vector::operator*(const float c) {
+Vector Vector::operator*(const float c) const {
 		return Vector(x*c, y*c, z*c);
 }
 
@@ -50,18 +50,113 @@ Vector Vector::operator*(const float c) {
 
 Point::Point(): x(0), y(0), z(0) {}    
 Point::Point(const float &x, const float &y, const float &z): x(x), y(y), z(z) {}
-Vector Point::operator-(Point &B) {
+Vector Point::operator-(const Point &B) const {
     return Vector(x - B.x, y - B.y, z - B.z);
 }
-Point Point::operator+(Point &B){
+Point Point::operator+(const Point &B) const {
     return Point(x + B.x, y + B.y, z + B.z);
 }
 
 
 
-Camera::Camera(const Point &o, const Vector &d, const float &fov): O(o), dir(d), FOV(fov) {}
-Vector Camera::point_to_vector(int i, int j) {
-	return Vector(j*2*tan(FOV*PI/180/2)/WIDTH, i*2*tan(FOV*PI/180/2)/WIDTH, 1);
+Transform::Transform()
+{
+    for(int i = 0; i < 3; ++i)
+        for(int j = 0; j < 4; ++j)
+            m[i][j] = i == j;
+}
+Transform Transform::translate(float x, float y, float z)
+{
+    Transform T;
+    T.m[0][3] = x;
+    T.m[1][3] = y;
+    T.m[2][3] = z;
+    return T;
+}
+Transform Transform::rotate(char axis, float degrees)
+{
+    int a = axis == 'x' ? 1 : (axis == 'y' ? 2 : 0), b = (a + 1) % 3; // the plane turned, a to b
+    float c = cos(degrees*PI/180), s = sin(degrees*PI/180);
+    Transform T;
+    T.m[a][a] = c; T.m[a][b] = -s;
+    T.m[b][a] = s; T.m[b][b] = c;
+    return T;
+}
+Transform Transform::scale(float s)
+{
+    Transform T;
+    T.m[0][0] = T.m[1][1] = T.m[2][2] = s;
+    return T;
+}
+Transform Transform::operator*(const Transform &B) const
+{
+    Transform T;
+    for(int i = 0; i < 3; ++i)
+        for(int j = 0; j < 4; ++j)
+            T.m[i][j] = m[i][0]*B.m[0][j] + m[i][1]*B.m[1][j] + m[i][2]*B.m[2][j] + (j == 3 ? m[i][3] : 0);
+    return T;
+}
+Transform Transform::inverse() const
+{
+    Transform T;
+    float det = m[0][0]*(m[1][1]*m[2][2] - m[1][2]*m[2][1]) - m[0][1]*(m[1][0]*m[2][2] - m[1][2]*m[2][0]) +
+                m[0][2]*(m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+    for(int i = 0; i < 3; ++i)
+        for(int j = 0; j < 3; ++j) // cofactor of m[j][i] over det
+        {
+            int r0 = (j + 1) % 3, r1 = (j + 2) % 3, c0 = (i + 1) % 3, c1 = (i + 2) % 3;
+            T.m[i][j] = (m[r0][c0]*m[r1][c1] - m[r0][c1]*m[r1][c0]) / det;
+        }
+    for(int i = 0; i < 3; ++i)
+        T.m[i][3] = -(T.m[i][0]*m[0][3] + T.m[i][1]*m[1][3] + T.m[i][2]*m[2][3]);
+    return T;
+}
+bool Transform::is_identity() const
+{
+    for(int i = 0; i < 3; ++i)
+        for(int j = 0; j < 4; ++j)
+            if(m[i][j] != (i == j))
+                return false;
+    return true;
+}
+Point Transform::apply(const Point &P) const
+{
+    return Point(m[0][0]*P.x + m[0][1]*P.y + m[0][2]*P.z + m[0][3],
+                 m[1][0]*P.x + m[1][1]*P.y + m[1][2]*P.z + m[1][3],
+                 m[2][0]*P.x + m[2][1]*P.y + m[2][2]*P.z + m[2][3]);
+}
+Vector Transform::apply(const Vector &V) const
+{
+    return Vector(m[0][0]*V.x + m[0][1]*V.y + m[0][2]*V.z,
+                  m[1][0]*V.x + m[1][1]*V.y + m[1][2]*V.z,
+                  m[2][0]*V.x + m[2][1]*V.y + m[2][2]*V.z);
+}
+Vector Transform::apply_transposed(const Vector &V) const
+{
+    return Vector(m[0][0]*V.x + m[1][0]*V.y + m[2][0]*V.z,
+                  m[0][1]*V.x + m[1][1]*V.y + m[2][1]*V.z,
+                  m[0][2]*V.x + m[1][2]*V.y + m[2][2]*V.z);
+}
+
+
+
+Camera::Camera(const Point &o, const Vector &d, const float &fov): O(o), dir(d), FOV(fov)
+{
+    forward = dir / dir.norm();
+    right = cross(Vector(0, 1, 0), forward);
+    if(right.norm() < 1e-6) // looking straight up or down
+        right = Vector(1, 0, 0);
+    right = right / right.norm();
+    up = cross(forward, right);
+}
+Vector Camera::point_to_vector(float i, float j) {
+	return right * (j*2*tan(FOV*PI/180/2)/WIDTH) + up * (i*2*tan(FOV*PI/180/2)/WIDTH) + forward;
+}
+Camera Camera::orbit(const Point &pivot, float degrees) const
+{
+    float c = cos(degrees*PI/180), s = sin(degrees*PI/180);
+    Vector o = O - pivot;
+    return Camera(pivot + Point(o.x*c + o.z*s, o.y, o.z*c - o.x*s), Vector(dir.x*c + dir.z*s, dir.y, dir.z*c - dir.x*s), FOV);
 }
 
 
@@ -105,6 +200,12 @@ std::pair<float, float> Sphere::IntersectRay(Point &O, Vector &D)
     float t2 = (-k2 - sqrt(discriminant)) / (2.f*k1);
     return std::make_pair(t1, t2);
 }
+bool Sphere::get_bbox(Point &min, Point &max)
+{
+    min = Point(center.x - radius, center.y - radius, center.z - radius);
+    max = Point(center.x + radius, center.y + radius, center.z + radius);
+    return true;
+}
 
 
 
@@ -125,6 +226,7 @@ std::pair<float, float> Plane::IntersectRay(Point &O, Vector &D)
     }
     return std::make_pair(INF, INF);
 }
+bool Plane::get_bbox(Point &min, Point &max) { return false;}
 
 
 
@@ -154,6 +256,12 @@ std::pair<float, float> Triangle::IntersectRay(Point &O, Vector &D)
     float tnear = edge2 * qvec * (1./det);
     return std::make_pair(tnear, INF);
 }
+bool Triangle::get_bbox(Point &min, Point &max)
+{
+    min = Point(std::min(v0.x, std::min(v1.x, v2.x)), std::min(v0.y, std::min(v1.y, v2.y)), std::min(v0.z, std::min(v1.z, v2.z)));
+    max = Point(std::max(v0.x, std::max(v1.x, v2.x)), std::max(v0.y, std::max(v1.y, v2.y)), std::max(v0.z, std::max(v1.z, v2.z)));
+    return true;
+}
 
 
 
@@ -165,7 +273,7 @@ Light::Light(const size_t &t, const float &intens, const Vector &v) : type(t), i
 
 
 
-Vector cross(Vector v1, Vector v2) {
+Vector cross(const Vector &v1, const Vector &v2) {
     return Vector(v1.y*v2.z - v1.z*v2.y, v1.z*v2.x - v1.x*v2.z, v1.x*v2.y - v1.y*v2.x);
 }
 
@@ -2,6 +2,7 @@
 #define GEOMETRY_H
 
 #include <cmath>
+#include <algorithm>
 #include <cstdint>
 #include <cassert>
 #include <iostream>
@@ -20,6 +21,37 @@ struct Color
 	Color operator+(const Color &K);
 };
 
+// Unclamped RGB radiance in the same 0..255 scale as Color. Shading sums it in float and
+// only hex() clamps and quantizes; the fourth lane pads it to one 16-byte SIMD register.
+struct alignas(16) Radiance
+{
+	float r;
+	float g;
+	float b;
+	float pad;
+
+	Radiance(): r(0), g(0), b(0), pad(0) {}
+	Radiance(float r, float g, float b): r(r), g(g), b(b), pad(0) {}
+	explicit Radiance(const Color &c): r(c.R), g(c.G), b(c.B), pad(0) {}
+	Radiance operator*(const float k) const {
+		return Radiance(r*k, g*k, b*k);
+	}
+	Radiance operator+(const Radiance &K) const {
+		return Radiance(r + K.r, g + K.g, b + K.b);
+	}
+	Radiance &operator+=(const Radiance &K) {
+		r += K.r; g += K.g; b += K.b;
+		return *this;
+	}
+	// Tone map for 8-bit output: clamp to [0, 255] and pack like Color::hex.
+	uint32_t hex() const {
+		uint32_t R = (uint32_t)std::min(255.f, std::max(0.f, r));
+		uint32_t G = (uint32_t)std::min(255.f, std::max(0.f, g));
+		uint32_t B = (uint32_t)std::min(255.f, std::max(0.f, b));
+		return R | (G << 8) | (B << 16);
+	}
+};
+
 struct Point;
 
 struct Vector
@@ -30,12 +62,12 @@ struct Vector
 
     Vector();
     Vector(const float &x, const float &y, const float &z);
-    float operator*(const Vector &B);
-    Vector operator+(const Vector &B);
-    Vector operator/(const float c);
-    float norm();
-    Point to_point(const float c);
-    Vector operator*(const float c);
+    float operator*(const Vector &B) const;
+    Vector operator+(const Vector &B) const;
+    Vector operator/(const float c) const;
+    float norm() const;
+    Point to_point(const float c) const;
+    Vector operator*(const float c) const;
 };
 
 struct Point
@@ -46,8 +78,26 @@ struct Point
 
     Point();
     Point(const float &x, const float &y, const float &z);
-    Vector operator-(Point &B);
-    Point operator+(Point &B);
+    Vector operator-(const Point &B) const;
+    Point operator+(const Point &B) const;
+};
+
+// Affine map P -> M P + t, row i of M in m[i][0..2] and t in m[i][3].
+struct Transform
+{
+    float m[3][4];
+
+    Transform(); // identity
+    static Transform translate(float x, float y, float z);
+    static Transform rotate(char axis, float degrees); // about the x, y or z axis
+    static Transform scale(float s);
+
+    Transform operator*(const Transform &B) const; // B first, then this
+    Transform inverse() const;
+    bool is_identity() const;
+    Point apply(const Point &P) const;
+    Vector apply(const Vector &V) const; // M V, no translation
+    Vector apply_transposed(const Vector &V) const; // M^T V, with the inverse this maps normals
 };
 
 struct Camera
@@ -55,9 +105,11 @@ struct Camera
     Point O;
     Vector dir;
     float FOV;
+    Vector right, up, forward; // unit basis from dir with y up, the identity for dir (0, 0, 1)
 
     Camera(const Point &o, const Vector &d, const float &fov);
-    Vector point_to_vector(int i, int j);
+    Vector point_to_vector(float i, float j);
+    Camera orbit(const Point &pivot, float degrees) const; // turned about the vertical axis through pivot
 };
 
 
@@ -84,6 +136,7 @@ struct Object
     virtual Material get_material(Point &P) = 0;
 	virtual Vector get_normal(Point &P) = 0;
 	virtual std::pair<float, float> IntersectRay(Point &O, Vector &D) = 0;
+	virtual bool get_bbox(Point &min, Point &max) = 0;
 };
 
 
@@ -97,6 +150,7 @@ struct Sphere : Object
     Material get_material(Point &P);
     Vector get_normal(Point &P);
     std::pair<float, float> IntersectRay(Point &O, Vector &D);
+    bool get_bbox(Point &min, Point &max);
 };
 
 
@@ -111,6 +165,7 @@ struct Plane : Object
     Material get_material(Point &P);
     Vector get_normal(Point &P);
     std::pair<float, float> IntersectRay(Point &O, Vector &D);
+    bool get_bbox(Point &min, Point &max);
 };
 
 
@@ -125,6 +180,7 @@ struct Triangle : Object
     Material get_material(Point &P);
     Vector get_normal(Point &P);
     std::pair<float, float> IntersectRay(Point &O, Vector &D);
+    bool get_bbox(Point &min, Point &max);
 };
 
 
@@ -140,7 +196,7 @@ struct Light
     Light(const size_t &t, const float &intens, const Vector &v);
 };
 
-Vector cross(Vector v1, Vector v2);
+Vector cross(const Vector &v1, const Vector &v2);
 
 
 #endif
\ No newline at end of file
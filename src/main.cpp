@@ -1,18 +1,74 @@
 #include <iostream>
 #include <cstdint>
+#include <cstdio>
 
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <chrono>
 
 #include "Bitmap.h"
+#include "geometry.h"
+#include "tri_simd.h"
+#include "sphere_simd.h"
+#include "stats.h"
+#include "trace.h"
 
 
-extern const int HEIGHT;
-extern const int WIDTH;
+extern int HEIGHT;
+extern int WIDTH;
 extern int threads;
-extern int sceneId;
-bool build_image(std::vector<uint32_t> &, int);
+extern int tile_size;
+extern int packet_size;
+extern int recursion_depth;
+extern const int MAX_RECURSION_DEPTH;
+extern float min_ray_weight;
+extern bool roulette;
+extern int aa_samples;
+extern float aa_threshold;
+extern int time_budget;
+extern bool mesh_cache;
+extern std::string SCENES_DIR;
+bool build_scene(const std::string &, Camera &);
+void render(std::vector<uint32_t> &, std::vector<Radiance> &, std::vector<uint32_t> &, Camera &);
+
+
+// "frame.bmp" -> "frame_0007.bmp" for frame 7 of a batch.
+static std::string FramePath(const std::string &path, size_t frame)
+{
+    char number[16];
+    snprintf(number, sizeof(number), "_%04zu", frame);
+    size_t dot = path.rfind('.');
+    if(dot == std::string::npos || (path.find('/', dot) != std::string::npos))
+        dot = path.size();
+    return path.substr(0, dot) + number + path.substr(dot);
+}
+
+// One camera per line: "ox oy oz dx dy dz [fov]", the scene's fov when it is left out.
+// Blank lines and lines starting with # are skipped.
+static bool LoadCameraPath(const std::string &path, float fov, std::vector<Camera> &cameras)
+{
+    std::ifstream in(path);
+    if(!in)
+        return false;
+    std::string line;
+    while(std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        float ox, oy, oz, dx, dy, dz;
+        if(!(fields >> ox))
+            continue;
+        if(!(fields >> oy >> oz >> dx >> dy >> dz))
+            return false;
+        float f = fov;
+        fields >> f;
+        cameras.push_back(Camera(Point(ox, oy, oz), Vector(dx, dy, dz), f));
+    }
+    return true;
+}
 
 
 int main(int argc, const char** argv)
@@ -36,24 +92,162 @@ int main(int argc, const char** argv)
         }
     }
 
+    // -scene takes a scene file, or the number of one of the scenes in SCENES_DIR
+    std::string scene = "1";
     if(cmdLineParams.find("-scene") != cmdLineParams.end())
-        sceneId = atoi(cmdLineParams["-scene"].c_str());
+        scene = cmdLineParams["-scene"];
+    std::string sceneName = "Scene_" + scene;
+    if(!scene.empty() && scene.find_first_not_of("0123456789") == std::string::npos)
+        scene = SCENES_DIR + "scene" + scene + ".scene";
+    else
+    {
+        sceneName = scene.substr(scene.find_last_of('/') + 1);
+        sceneName = sceneName.substr(0, sceneName.rfind('.'));
+    }
 
     std::string outFilePath;
     if(cmdLineParams.find("-out") != cmdLineParams.end())
         outFilePath = cmdLineParams["-out"];
     else
-        outFilePath = std::string("Scene_") + std::to_string(sceneId) + ".bmp";
+        outFilePath = sceneName + ".bmp";
 
     
     if(cmdLineParams.find("-threads") != cmdLineParams.end())
         threads = atoi(cmdLineParams["-threads"].c_str());
 
+    if(cmdLineParams.find("-mesh-cache") != cmdLineParams.end())
+        mesh_cache = atoi(cmdLineParams["-mesh-cache"].c_str()) != 0;
+
+    if(cmdLineParams.find("-simd") != cmdLineParams.end() &&
+       !(use_tri_kernel(cmdLineParams["-simd"].c_str()) && use_sphere_kernel(cmdLineParams["-simd"].c_str())))
+    {
+        std::cerr << "Unsupported SIMD kernel: " << cmdLineParams["-simd"] << std::endl;
+        return 1;
+    }
+
+    if(cmdLineParams.find("-width") != cmdLineParams.end())
+        WIDTH = atoi(cmdLineParams["-width"].c_str());
+
+    if(cmdLineParams.find("-height") != cmdLineParams.end())
+        HEIGHT = atoi(cmdLineParams["-height"].c_str());
+
+    if(WIDTH <= 0 || HEIGHT <= 0)
+    {
+        std::cerr << "Bad resolution: " << WIDTH << "x" << HEIGHT << std::endl;
+        return 1;
+    }
+
+    if(cmdLineParams.find("-tile") != cmdLineParams.end())
+        tile_size = std::max(1, atoi(cmdLineParams["-tile"].c_str()));
+
+    if(cmdLineParams.find("-packet") != cmdLineParams.end())
+        packet_size = atoi(cmdLineParams["-packet"].c_str());
+
+    if(packet_size < 1 || packet_size * packet_size > 64)
+    {
+        std::cerr << "Bad packet size: " << packet_size << " (1 to 8)" << std::endl;
+        return 1;
+    }
+
+    if(cmdLineParams.find("-depth") != cmdLineParams.end())
+        recursion_depth = atoi(cmdLineParams["-depth"].c_str());
+
+    if(recursion_depth < 0 || recursion_depth > MAX_RECURSION_DEPTH)
+    {
+        std::cerr << "Bad recursion depth: " << recursion_depth << " (0 to " << MAX_RECURSION_DEPTH << ")" << std::endl;
+        return 1;
+    }
+
+    if(cmdLineParams.find("-min-weight") != cmdLineParams.end())
+        min_ray_weight = std::max(0.f, (float)atof(cmdLineParams["-min-weight"].c_str()));
+
+    if(cmdLineParams.find("-roulette") != cmdLineParams.end())
+        roulette = atoi(cmdLineParams["-roulette"].c_str()) != 0;
+
+    if(cmdLineParams.find("-aa-samples") != cmdLineParams.end())
+        aa_samples = std::max(1, atoi(cmdLineParams["-aa-samples"].c_str()));
+
+    if(cmdLineParams.find("-aa-threshold") != cmdLineParams.end())
+        aa_threshold = std::max(0.f, (float)atof(cmdLineParams["-aa-threshold"].c_str()));
+
+    if(cmdLineParams.find("-time-budget") != cmdLineParams.end())
+        time_budget = std::max(0, atoi(cmdLineParams["-time-budget"].c_str()));
+
 
     std::vector<uint32_t> image(HEIGHT * WIDTH, 0); 
-    
-    if(build_image(image, sceneId))
-        SaveBMP(outFilePath.c_str(), image.data(), WIDTH, HEIGHT);
+    std::vector<Radiance> hdr;
+    if(cmdLineParams.find("-hdr") != cmdLineParams.end())
+        hdr.resize(HEIGHT * WIDTH);
+    std::vector<uint32_t> cost;
+    if(cmdLineParams.find("-heatmap") != cmdLineParams.end())
+        cost.resize(HEIGHT * WIDTH);
+
+    if(cmdLineParams.find("-trace") != cmdLineParams.end())
+        StartTrace();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Camera camera(Point(0, 0, 0), Vector(0, 0, 1), 60);
+    if(!build_scene(scene, camera))
+        return 1;
+    float setup = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+    // A batch renders every camera against the one loaded scene and numbers its outputs.
+    std::vector<Camera> cameras;
+    bool batch = false;
+    if(cmdLineParams.find("-camera-path") != cmdLineParams.end())
+    {
+        batch = true;
+        if(!LoadCameraPath(cmdLineParams["-camera-path"], camera.FOV, cameras))
+        {
+            std::cerr << "Error: can not read the camera path " << cmdLineParams["-camera-path"] << std::endl;
+            return 1;
+        }
+    }
+    else if(cmdLineParams.find("-turntable") != cmdLineParams.end())
+    {
+        batch = true;
+        int frames = std::max(1, atoi(cmdLineParams["-turntable"].c_str()));
+        Point pivot;
+        if(cmdLineParams.find("-pivot") != cmdLineParams.end() &&
+           sscanf(cmdLineParams["-pivot"].c_str(), "%f,%f,%f", &pivot.x, &pivot.y, &pivot.z) != 3)
+        {
+            std::cerr << "Bad pivot: " << cmdLineParams["-pivot"] << " (x,y,z)" << std::endl;
+            return 1;
+        }
+        for(int i = 0; i < frames; ++i)
+            cameras.push_back(camera.orbit(pivot, 360.f * i / frames));
+    }
+    else
+        cameras.push_back(camera);
+
+    for(size_t i = 0; i < cameras.size(); ++i)
+    {
+        if(batch)
+            std::cout << "Frame " << i << " of " << cameras.size() << std::endl;
+        render(image, hdr, cost, cameras[i]);
+        std::chrono::steady_clock::time_point write = std::chrono::steady_clock::now();
+        SaveBMP((batch ? FramePath(outFilePath, i) : outFilePath).c_str(), image.data(), WIDTH, HEIGHT);
+        if(!hdr.empty())
+            SaveHDR((batch ? FramePath(cmdLineParams["-hdr"], i) : cmdLineParams["-hdr"]).c_str(), &hdr[0].r,
+                    sizeof(Radiance) / sizeof(float), WIDTH, HEIGHT, 1.f / 255);
+        if(!cost.empty())
+        {
+            SaveHeatmap((batch ? FramePath(cmdLineParams["-heatmap"], i) : cmdLineParams["-heatmap"]).c_str(), cost.data(), WIDTH, HEIGHT);
+            std::cout << "Heatmap: " << *std::min_element(cost.begin(), cost.end()) << " to "
+                      << *std::max_element(cost.begin(), cost.end()) << " rays per pixel" << std::endl;
+        }
+        stats.image_write += std::chrono::duration<double>(std::chrono::steady_clock::now() - write).count();
+        TraceSpan("Image write", "io", write, std::chrono::steady_clock::now());
+    }
+    if(batch)
+        std::cout << "Batch: " << cameras.size() << " frames in "
+                  << std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count() << " s, scene setup "
+                  << setup << " s" << std::endl;
+
+    stats.print();
+    if(cmdLineParams.find("-stats-json") != cmdLineParams.end() && !stats.write_json(cmdLineParams["-stats-json"]))
+        std::cerr << "Warning: can not write " << cmdLineParams["-stats-json"] << std::endl;
+    if(cmdLineParams.find("-trace") != cmdLineParams.end() && !WriteTrace(cmdLineParams["-trace"]))
+        std::cerr << "Warning: can not write " << cmdLineParams["-trace"] << std::endl;
 
 
     std::cout << "Done." << std::endl;
@@ -0,0 +1,103 @@
+#include "mapped_file.h"
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+
+MappedFile::MappedFile() : ptr(NULL), len(0) {}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string &path)
+{
+    close();
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+    if (in.fail())
+        return false;
+    in.seekg(0, std::ios::end);
+    buffer.resize((size_t)in.tellg());
+    in.seekg(0, std::ios::beg);
+    in.read(buffer.data(), buffer.size());
+    ptr = buffer.data();
+    len = buffer.size();
+    return true;
+}
+
+void MappedFile::close()
+{
+    std::vector<char>().swap(buffer);
+    ptr = NULL;
+    len = 0;
+}
+
+#else
+
+bool MappedFile::open(const std::string &path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    len = (size_t)st.st_size;
+    if (len) {
+        void *p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            ::close(fd);
+            len = 0;
+            return false;
+        }
+        madvise(p, len, MADV_SEQUENTIAL);
+        ptr = (const char *)p;
+    }
+    ::close(fd);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (ptr)
+        munmap((void *)ptr, len);
+    ptr = NULL;
+    len = 0;
+}
+
+#endif
+
+const char *MappedFile::data() const {
+    return ptr;
+}
+
+size_t MappedFile::size() const {
+    return len;
+}
+
+bool file_stamp(const std::string &path, uint64_t &size, int64_t &mtime)
+{
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(path.c_str(), &st) != 0)
+        return false;
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+#endif
+    size = (uint64_t)st.st_size;
+    mtime = (int64_t)st.st_mtime;
+    return true;
+}
@@ -0,0 +1,33 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+
+// Read-only view of a whole file: mmap where available, a plain read otherwise.
+class MappedFile {
+private:
+    const char *ptr;
+    size_t len;
+#ifdef _WIN32
+    std::vector<char> buffer;
+#endif
+public:
+    MappedFile();
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool open(const std::string &path);
+    void close();
+    const char *data() const;
+    size_t size() const;
+};
+
+// Size and modification time of a file, false if it can not be stat'ed.
+bool file_stamp(const std::string &path, uint64_t &size, int64_t &mtime);
+
+#endif
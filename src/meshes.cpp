@@ -0,0 +1,189 @@
+#include <iostream>
+#include <map>
+#include "meshes.h"
+
+
+void MeshStore::build(const std::vector<MeshDesc> &descs)
+{
+    meshes.clear();
+    files.clear();
+    instances.clear();
+    std::map<std::string, int> loaded;
+    std::vector<AABB> boxes;
+
+    for(const MeshDesc &desc: descs)
+    {
+        std::map<std::string, int>::const_iterator it = loaded.find(desc.file);
+        int mesh = it != loaded.end() ? it->second : (int)meshes.size();
+        if(it == loaded.end())
+        {
+            meshes.push_back(Model(desc.file.c_str()));
+            files.push_back(desc.file);
+            loaded[desc.file] = mesh;
+        }
+
+        MeshInstance inst;
+        inst.mesh = mesh;
+        inst.to_object = desc.transform.inverse();
+        inst.moved = !desc.transform.is_identity();
+        inst.material = desc.material;
+        instances.push_back(inst);
+
+        // world bounds from the corners of the mesh's root box
+        AABB box;
+        const Buffer<BVHNode> &nodes = meshes[mesh].bvh.nodes;
+        for(int corner = 0; corner < 8 && !nodes.empty(); ++corner)
+        {
+            const AABB &b = nodes[0].box;
+            box.grow(desc.transform.apply(Point(corner & 1 ? b.max.x : b.min.x, corner & 2 ? b.max.y : b.min.y, corner & 4 ? b.max.z : b.min.z)));
+        }
+        boxes.push_back(box);
+    }
+
+    bvh.build(boxes, 1);
+    if(!instances.empty())
+        std::cout << "Meshes: " << meshes.size() << " loaded, " << instances.size() << " instances, BVH of " << bvh.nnodes()
+                  << " nodes built in " << bvh.build_ms << " ms" << std::endl;
+}
+
+
+namespace {
+struct InstanceHit
+{
+    const MeshStore &store;
+    const Point &O;
+    const Vector &D;
+    int instance;
+    int tri;
+
+    InstanceHit(const MeshStore &s, const Point &o, const Vector &d) : store(s), O(o), D(d), instance(-1), tri(-1) {}
+    bool operator()(int first, int count, float /*t_min*/, float &t_max)
+    {
+        bool found = false;
+        for(int i = first; i < first + count; ++i)
+        {
+            int k = store.bvh.prims[i];
+            const MeshInstance &inst = store.instances[k];
+            const Model &mesh = store.meshes[inst.mesh];
+            bool hit = inst.moved ? mesh.intersect(inst.to_object.apply(O), inst.to_object.apply(D), t_max, tri)
+                                  : mesh.intersect(O, D, t_max, tri);
+            if(hit)
+            {
+                instance = k;
+                found = true;
+            }
+        }
+        return found;
+    }
+};
+
+struct InstanceOcclusion
+{
+    const MeshStore &store;
+    const Point &O;
+    const Vector &D;
+    int instance;
+
+    InstanceOcclusion(const MeshStore &s, const Point &o, const Vector &d) : store(s), O(o), D(d), instance(-1) {}
+    bool operator()(int first, int count, float /*t_min*/, float t_max)
+    {
+        for(int i = first; i < first + count; ++i)
+        {
+            int k = store.bvh.prims[i];
+            const MeshInstance &inst = store.instances[k];
+            const Model &mesh = store.meshes[inst.mesh];
+            if(inst.moved ? mesh.occluded(inst.to_object.apply(O), inst.to_object.apply(D), t_max) : mesh.occluded(O, D, t_max))
+            {
+                instance = k;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Gathers the lanes reaching an instance into an object space packet for the mesh's own
+// packet traversal and scatters the hits back.
+struct InstancePacketHit
+{
+    const MeshStore &store;
+    RayPacket &rays;
+    int *instance;
+    int *tri;
+
+    InstancePacketHit(const MeshStore &s, RayPacket &r, int *i, int *t) : store(s), rays(r), instance(i), tri(t) {}
+    uint64_t operator()(int first, int count, uint64_t lanes, float /*t_min*/)
+    {
+        uint64_t found = 0;
+        for(int i = first; i < first + count; ++i)
+        {
+            int k = store.bvh.prims[i];
+            const MeshInstance &inst = store.instances[k];
+            RayPacket local;
+            int lane_of[BVH_PACKET_MAX], local_tri[BVH_PACKET_MAX];
+            for(uint64_t m = lanes; m; m &= m - 1)
+            {
+                int lane = ctz64(m);
+                lane_of[local.size] = lane;
+                if(inst.moved)
+                    local.add(inst.to_object.apply(rays.origin(lane)), inst.to_object.apply(rays.dir(lane)), rays.t_max[lane]);
+                else
+                    local.add(rays.origin(lane), rays.dir(lane), rays.t_max[lane]);
+            }
+            for(uint64_t hit = store.meshes[inst.mesh].intersect_packet(local, local_tri); hit; hit &= hit - 1)
+            {
+                int l = ctz64(hit), lane = lane_of[l];
+                rays.t_max[lane] = local.t_max[l];
+                instance[lane] = k;
+                tri[lane] = local_tri[l];
+                found |= (uint64_t)1 << lane;
+            }
+        }
+        return found;
+    }
+};
+}
+
+bool MeshStore::intersect(const Point &O, const Vector &D, float &t_max, int &instance, int &tri) const
+{
+    InstanceHit hit(*this, O, D);
+    if(!bvh.traverse(O, D, 1e-5f, t_max, hit))
+        return false;
+    instance = hit.instance;
+    tri = hit.tri;
+    return true;
+}
+
+uint64_t MeshStore::intersect_packet(RayPacket &rays, int *instance, int *tri) const
+{
+    InstancePacketHit hit(*this, rays, instance, tri);
+    return bvh.traverse_packet_leaves(rays, 1e-5f, hit);
+}
+
+bool MeshStore::occluded(const Point &O, const Vector &D, float t_max, int &instance) const
+{
+    InstanceOcclusion hit(*this, O, D);
+    if(!bvh.occluded(O, D, 1e-5f, t_max, hit))
+        return false;
+    instance = hit.instance;
+    return true;
+}
+
+// Normals go to world space with the transpose of the inverse.
+Vector MeshStore::normal(int instance, int tri) const
+{
+    const MeshInstance &inst = instances[instance];
+    Vector N = meshes[inst.mesh].normal(tri);
+    if(!inst.moved)
+        return N;
+    N = inst.to_object.apply_transposed(N);
+    return N / N.norm();
+}
+
+
+void MeshStore::reset_counters()
+{
+    bvh.reset_counters();
+    for(Model &mesh: meshes)
+        mesh.bvh.reset_counters();
+}
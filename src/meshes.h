@@ -0,0 +1,51 @@
+#ifndef MESHES_H
+#define MESHES_H
+
+#include <vector>
+#include <string>
+#include "geometry.h"
+#include "bvh.h"
+#include "model.h"
+#include "scene.h"
+
+
+// One placement of a mesh. Rays are taken into object space with to_object, whose
+// linear part keeps them unnormalized so hit distances stay world distances.
+struct MeshInstance
+{
+    int mesh; // index in MeshStore::meshes
+    Transform to_object;
+    bool moved; // false for the identity transform, then rays skip the transform
+    Material material;
+};
+
+
+// The scene's meshes, each loaded once with its own BVH no matter how many instances
+// place it, and a top-level BVH over the instances' world bounds.
+class MeshStore {
+public:
+    std::vector<Model> meshes;
+    std::vector<std::string> files; // OBJ file of each mesh
+    std::vector<MeshInstance> instances;
+    BVH bvh; // over instances, leaves hold one each
+
+    // Loads every distinct mesh file once and places one instance per scene mesh.
+    void build(const std::vector<MeshDesc> &descs);
+    bool empty() const {
+        return instances.empty();
+    }
+
+    // Closest hit within t_max, which shrinks to its distance.
+    bool intersect(const Point &O, const Vector &D, float &t_max, int &instance, int &tri) const;
+    // Closest hits for a packet, every instance testing all the lanes that reach it as one
+    // packet. Returns the mask of lanes that hit, with instance[lane] and tri[lane] set.
+    uint64_t intersect_packet(RayPacket &rays, int *instance, int *tri) const;
+    // Any instance hit closer than t_max, instance is set to it.
+    bool occluded(const Point &O, const Vector &D, float t_max, int &instance) const;
+    Vector normal(int instance, int tri) const;
+
+    void reset_counters();
+};
+
+
+#endif
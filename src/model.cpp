@@ -1,69 +1,548 @@
+#include <chrono>
+#include <cstring>
+#include <omp.h>
 #include "model.h"
+#include "mapped_file.h"
+#include <cstdio>
 
 
-Model::Model(const char *filename) : verts(), faces() {
+namespace {
+
+// One newline-aligned slice of the OBJ file, parsed independently of the others.
+struct ObjChunk {
+    const char *begin;
+    const char *end;
+    std::vector<Point> verts;
+    std::vector<int> indices;
+    std::vector<size_t> relative; // positions in indices that count from the chunk's first vertex
+    bool bad;
+
+    ObjChunk() : begin(NULL), end(NULL), bad(false) {}
+};
+
+struct ObjRef {
+    int index;
+    bool relative;
+};
+
+inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+inline const char *skip_space(const char *p, const char *end) {
+    while (p < end && is_space(*p))
+        ++p;
+    return p;
+}
+
+bool parse_int(const char *&p, const char *end, int &value) {
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        neg = *p++ == '-';
+    if (p == end || !is_digit(*p))
+        return false;
+    int v = 0;
+    while (p < end && is_digit(*p))
+        v = v*10 + (*p++ - '0');
+    value = neg ? -v : v;
+    return true;
+}
+
+bool parse_float(const char *&p, const char *end, float &value) {
+    static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    p = skip_space(p, end);
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        neg = *p++ == '-';
+    uint64_t mantissa = 0;
+    int exponent = 0, digits = 0;
+    for (; p < end && is_digit(*p); ++p, ++digits) {
+        if (mantissa < 100000000000000000ull)
+            mantissa = mantissa*10 + (*p - '0');
+        else
+            exponent++;
+    }
+    if (p < end && *p == '.')
+        for (++p; p < end && is_digit(*p); ++p, ++digits) {
+            if (mantissa < 100000000000000000ull) {
+                mantissa = mantissa*10 + (*p - '0');
+                exponent--;
+            }
+        }
+    if (!digits)
+        return false;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        int e;
+        if (parse_int(q, end, e)) {
+            exponent += e;
+            p = q;
+        }
+    }
+    double v = (double)mantissa;
+    if (exponent < 0)
+        v = -exponent <= 22 ? v / pow10[-exponent] : v * pow(10., exponent);
+    else if (exponent > 0)
+        v = exponent <= 22 ? v * pow10[exponent] : v * pow(10., exponent);
+    value = (float)(neg ? -v : v);
+    return true;
+}
+
+void push_ref(ObjChunk &c, const ObjRef &r) {
+    if (r.relative)
+        c.relative.push_back(c.indices.size());
+    c.indices.push_back(r.index);
+}
+
+// "v x y z" and "f a b c ...", face corners may carry /vt/vn and polygons are fanned into triangles.
+void parse_chunk(ObjChunk &c) {
+    const char *p = c.begin;
+    while (p < c.end) {
+        const char *eol = (const char *)memchr(p, '\n', c.end - p);
+        if (!eol)
+            eol = c.end;
+        p = skip_space(p, eol);
+        if (p + 1 < eol && p[0] == 'v' && is_space(p[1])) {
+            Point v;
+            p += 2;
+            if (!parse_float(p, eol, v.x) || !parse_float(p, eol, v.y) || !parse_float(p, eol, v.z))
+                c.bad = true;
+            c.verts.push_back(v);
+        } else if (p + 1 < eol && p[0] == 'f' && is_space(p[1])) {
+            ObjRef first, prev, cur;
+            int n = 0, idx;
+            for (p = skip_space(p + 2, eol); p < eol && parse_int(p, eol, idx); p = skip_space(p, eol), ++n) {
+                while (p < eol && !is_space(*p))
+                    ++p;
+                if (idx == 0)
+                    c.bad = true;
+                cur.relative = idx < 0;
+                cur.index = idx < 0 ? (int)c.verts.size() + idx : idx - 1;
+                if (n == 0)
+                    first = cur;
+                else if (n >= 2) {
+                    push_ref(c, first);
+                    push_ref(c, prev);
+                    push_ref(c, cur);
+                }
+                prev = cur;
+            }
+            if (n < 3)
+                c.bad = true;
+        }
+        p = eol + 1;
+    }
+}
+
+}
+
+
+Model::Model(const char *filename) : verts(), indices() {
     exist = true;
     material = Material();
-    std::ifstream in;
-    in.open ((MODELS_DIR + filename).c_str(), std::ifstream::in);
-    if (in.fail()) {
-        std::cerr << "Failed to open model file: " << filename << std::endl;
+    std::string path = MODELS_DIR + filename;
+    std::string cache = path + ".cache";
+    if (mesh_cache && load_cache(cache, path))
+        return;
+
+    load_obj(path);
+    std::vector<AABB> boxes(nfaces());
+    for (int i=0; i<nfaces(); ++i)
+        for (int j=0; j<3; ++j)
+            boxes[i].grow(point(vert(i,j)));
+    // A triangle costs a quarter of a node visit, so a full leaf of TRI_PACKET_WIDTH triangles
+    // costs about two visits and leaves fill up to a packet.
+    bvh.build(boxes, TRI_PACKET_WIDTH, 0.25f);
+    bvh.pad_leaves(TRI_PACKET_WIDTH);
+    build_tris();
+    std::cout << "Model: BVH of " << bvh.nnodes() << " nodes built in " << bvh.build_ms << " ms" << std::endl;
+
+    if (mesh_cache)
+        save_cache(cache, path);
+}
+
+
+void Model::load_obj(const std::string &path) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    MappedFile file;
+    if (!file.open(path)) {
+        std::cerr << "Failed to open model file: " << path << std::endl;
         exit(1);
     }
-    std::string line;
-    while (!in.eof()) {
-        std::getline(in, line);
-        std::istringstream iss(line.c_str());
-        char trash;
-        if (!line.compare(0, 2, "v ")) {
-            iss >> trash;
-            Point v;
-            iss >> v.x;
-            iss >> v.y;
-            iss >> v.z;
-            verts.push_back(v);
-        } else if (!line.compare(0, 2, "f ")) {
-            Vector f;
-            int idx, cnt=0;
-            iss >> trash;
-            iss >> f.x;
-            f.x--;
-            iss >> f.y;
-            f.y--;
-            iss >> f.z;
-            f.z--;
-            faces.push_back(f);
+
+    // Split at line boundaries, a few chunks per thread so uneven ones balance out.
+    const char *data = file.data(), *end = data + file.size();
+    int nchunks = std::max(1, std::min((int)(file.size() >> 20) + 1, omp_get_max_threads() * 4));
+    std::vector<ObjChunk> chunks(nchunks);
+    const char *p = data;
+    for (int i = 0; i < nchunks; ++i) {
+        const char *q = (i + 1 == nchunks) ? end : std::max(p, data + file.size() * (i + 1) / nchunks);
+        if (q < end && q > data && q[-1] != '\n') {
+            q = (const char *)memchr(q, '\n', end - q);
+            q = q ? q + 1 : end;
+        }
+        chunks[i].begin = p;
+        chunks[i].end = q;
+        p = q;
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < nchunks; ++i)
+        parse_chunk(chunks[i]);
+
+    std::vector<size_t> vert_base(nchunks + 1, 0), index_base(nchunks + 1, 0);
+    for (int i = 0; i < nchunks; ++i) {
+        vert_base[i + 1] = vert_base[i] + chunks[i].verts.size();
+        index_base[i + 1] = index_base[i] + chunks[i].indices.size();
+    }
+    std::vector<Point> all_verts(vert_base[nchunks]);
+    std::vector<uint32_t> all_indices(index_base[nchunks]);
+
+    bool bad = false;
+    #pragma omp parallel for reduction(||:bad)
+    for (int i = 0; i < nchunks; ++i) {
+        ObjChunk &c = chunks[i];
+        for (size_t k : c.relative)
+            c.indices[k] += (int)vert_base[i];
+        std::copy(c.verts.begin(), c.verts.end(), all_verts.begin() + vert_base[i]);
+        for (size_t k = 0; k < c.indices.size(); ++k) {
+            if (c.indices[k] < 0 || c.indices[k] >= (int)all_verts.size())
+                c.bad = true;
+            all_indices[index_base[i] + k] = (uint32_t)c.indices[k];
+        }
+        bad = bad || c.bad;
+    }
+    if (bad) {
+        std::cerr << "Malformed model file: " << path << std::endl;
+        exit(1);
+    }
+    verts = Buffer<Point>(std::move(all_verts));
+    indices = Buffer<uint32_t>(std::move(all_indices));
+
+    float load_s = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Model: " << path << ", " << nverts() << " verts, " << nfaces() << " faces, parsed in " << load_s * 1000 << " ms ("
+              << file.size() / (1024. * 1024.) / load_s << " MB/s, " << nchunks << " chunks)" << std::endl;
+}
+
+
+void Model::build_tris() {
+    std::vector<TriAccel> records(bvh.prims.size());
+    std::vector<TriPacket> soa(bvh.prims.size() / TRI_PACKET_WIDTH);
+    #pragma omp parallel for
+    for (int i = 0; i < (int)records.size(); ++i) {
+        int fi = bvh.prims[i];
+        TriAccel &tri = records[i];
+        if (fi < 0) {
+            tri = TriAccel();
+        } else {
+            tri.v0 = point(vert(fi,0));
+            tri.edge1 = point(vert(fi,1)) - tri.v0;
+            tri.edge2 = point(vert(fi,2)) - tri.v0;
+            tri.normal = cross(tri.edge1, tri.edge2);
+            tri.normal = tri.normal / tri.normal.norm();
+        }
+
+        TriPacket &p = soa[i / TRI_PACKET_WIDTH];
+        int lane = i % TRI_PACKET_WIDTH;
+        p.v0x[lane] = tri.v0.x;    p.v0y[lane] = tri.v0.y;    p.v0z[lane] = tri.v0.z;
+        p.e1x[lane] = tri.edge1.x; p.e1y[lane] = tri.edge1.y; p.e1z[lane] = tri.edge1.z;
+        p.e2x[lane] = tri.edge2.x; p.e2y[lane] = tri.edge2.y; p.e2z[lane] = tri.edge2.z;
+    }
+    tris = Buffer<TriAccel>(std::move(records));
+    packets = Buffer<TriPacket>(std::move(soa));
+}
+
+
+// Binary cache next to the OBJ: a header followed by the vertex, index, BVH node,
+// BVH primitive, triangle record and triangle packet arrays in native layout, each section 16-byte aligned so the
+// mapped file can be used in place.
+#define MESH_CACHE_VERSION 3
+
+namespace {
+
+struct MeshCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t point_size;
+    uint32_t node_size;
+    uint32_t tri_size;
+    uint32_t packet_size;
+    uint32_t reserved;
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t nverts;
+    uint64_t nindices;
+    uint64_t nnodes;
+    uint64_t nprims;
+    uint64_t ntris;
+    uint64_t npackets;
+};
+
+const char MESH_CACHE_MAGIC[8] = {'R', 'T', 'M', 'E', 'S', 'H', 0, 0};
+
+size_t align16(size_t n) {
+    return (n + 15) & ~(size_t)15;
+}
+
+// Section offsets for the given header, returns the total file size.
+size_t cache_layout(const MeshCacheHeader &h, size_t offsets[6]) {
+    size_t sizes[6] = {h.nverts * sizeof(Point), h.nindices * sizeof(uint32_t), h.nnodes * sizeof(BVHNode), h.nprims * sizeof(int),
+                       h.ntris * sizeof(TriAccel), h.npackets * sizeof(TriPacket)};
+    size_t at = align16(sizeof(MeshCacheHeader));
+    for (int i = 0; i < 6; ++i) {
+        offsets[i] = at;
+        at = align16(at + sizes[i]);
+    }
+    return at;
+}
+
+// The cache's indices point where they should: faces at vertices, leaf slots at faces (or
+// -1 for padding) and leaves into the slots. The nodes must form one tree, each reached from
+// exactly one parent, no deeper than BVH_MAX_DEPTH, which the traversal stacks are sized for.
+bool cache_indices_valid(const MeshCacheHeader &h, const char *data, const size_t offsets[6]) {
+    const uint32_t *indices = (const uint32_t *)(data + offsets[1]);
+    for (uint64_t i = 0; i < h.nindices; ++i)
+        if (indices[i] >= h.nverts)
+            return false;
+
+    const int *prims = (const int *)(data + offsets[3]);
+    for (uint64_t i = 0; i < h.nprims; ++i)
+        if (prims[i] < -1 || prims[i] >= (int64_t)(h.nindices / 3))
+            return false;
+
+    const BVHNode *nodes = (const BVHNode *)(data + offsets[2]);
+    for (uint64_t i = 0; i < h.nnodes; ++i) {
+        const BVHNode &n = nodes[i];
+        bool leaf_ok = n.count > 0 && n.first >= 0 && (uint64_t)n.first + n.count <= h.nprims;
+        bool inner_ok = n.count == 0 && (uint64_t)n.first > i + 1 && (uint64_t)n.first < h.nnodes;
+        if (!leaf_ok && !inner_ok)
+            return false;
+    }
+
+    if (h.nnodes == 0)
+        return true;
+    std::vector<char> reached(h.nnodes, 0);
+    std::vector<std::pair<uint64_t, int> > stack(1, std::make_pair((uint64_t)0, 0));
+    reached[0] = 1;
+    uint64_t nreached = 1;
+    while (!stack.empty()) {
+        uint64_t i = stack.back().first;
+        int depth = stack.back().second;
+        stack.pop_back();
+        if (depth > BVH_MAX_DEPTH)
+            return false;
+        if (nodes[i].count)
+            continue;
+        uint64_t children[2] = {i + 1, (uint64_t)nodes[i].first};
+        for (uint64_t child : children) {
+            if (reached[child]++)
+                return false;
+            nreached++;
+            stack.push_back(std::make_pair(child, depth + 1));
         }
     }
+    return nreached == h.nnodes;
+}
+
+}
+
+bool Model::load_cache(const std::string &cache, const std::string &source) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    uint64_t source_size;
+    int64_t source_mtime;
+    if (!file_stamp(source, source_size, source_mtime))
+        return false;
+
+    std::shared_ptr<MappedFile> file(new MappedFile());
+    if (!file->open(cache) || file->size() < sizeof(MeshCacheHeader))
+        return false;
+
+    MeshCacheHeader h;
+    memcpy(&h, file->data(), sizeof(h));
+    size_t offsets[6];
+    if (memcmp(h.magic, MESH_CACHE_MAGIC, sizeof(h.magic)) || h.version != MESH_CACHE_VERSION ||
+        h.point_size != sizeof(Point) || h.node_size != sizeof(BVHNode) || h.tri_size != sizeof(TriAccel) ||
+        h.packet_size != sizeof(TriPacket) || h.nindices % 3 || h.ntris != h.nprims ||
+        h.npackets * TRI_PACKET_WIDTH != h.ntris ||
+        cache_layout(h, offsets) != file->size()) {
+        std::cerr << "Ignoring incompatible model cache: " << cache << std::endl;
+        return false;
+    }
+    if (h.source_size != source_size || h.source_mtime != source_mtime) {
+        std::cout << "Model: cache is out of date, reloading " << source << std::endl;
+        return false;
+    }
+
+    const char *data = file->data();
+    if (!cache_indices_valid(h, data, offsets)) {
+        std::cerr << "Ignoring corrupt model cache: " << cache << std::endl;
+        return false;
+    }
+    verts = Buffer<Point>((const Point *)(data + offsets[0]), h.nverts, file);
+    indices = Buffer<uint32_t>((const uint32_t *)(data + offsets[1]), h.nindices, file);
+    bvh.nodes = Buffer<BVHNode>((const BVHNode *)(data + offsets[2]), h.nnodes, file);
+    bvh.prims = Buffer<int>((const int *)(data + offsets[3]), h.nprims, file);
+    tris = Buffer<TriAccel>((const TriAccel *)(data + offsets[4]), h.ntris, file);
+    packets = Buffer<TriPacket>((const TriPacket *)(data + offsets[5]), h.npackets, file);
+    bvh.build_ms = 0;
+
+    float load_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Model: " << cache << ", " << nverts() << " verts, " << nfaces() << " faces, BVH of " << bvh.nnodes()
+              << " nodes, mapped in " << load_ms << " ms" << std::endl;
+    return true;
+}
+
+void Model::save_cache(const std::string &cache, const std::string &source) const {
+    MeshCacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MESH_CACHE_MAGIC, sizeof(h.magic));
+    h.version = MESH_CACHE_VERSION;
+    h.point_size = sizeof(Point);
+    h.node_size = sizeof(BVHNode);
+    h.tri_size = sizeof(TriAccel);
+    h.packet_size = sizeof(TriPacket);
+    if (!file_stamp(source, h.source_size, h.source_mtime))
+        return;
+    h.nverts = verts.size();
+    h.nindices = indices.size();
+    h.nnodes = bvh.nodes.size();
+    h.nprims = bvh.prims.size();
+    h.ntris = tris.size();
+    h.npackets = packets.size();
+
+    size_t offsets[6];
+    size_t total = cache_layout(h, offsets);
+    const void *sections[6] = {verts.data(), indices.data(), bvh.nodes.data(), bvh.prims.data(), tris.data(), packets.data()};
+    size_t sizes[6] = {verts.size() * sizeof(Point), indices.size() * sizeof(uint32_t), bvh.nodes.size() * sizeof(BVHNode),
+                       bvh.prims.size() * sizeof(int), tris.size() * sizeof(TriAccel), packets.size() * sizeof(TriPacket)};
+
+    // Written under a temporary name and renamed, so a reader never maps a half-written cache.
+    std::string tmp = cache + ".tmp";
+    std::ofstream out(tmp.c_str(), std::ios::out | std::ios::binary);
+    const char zeros[16] = {0};
+    out.write((const char *)&h, sizeof(h));
+    size_t at = sizeof(h);
+    for (int i = 0; i < 6; ++i) {
+        out.write(zeros, offsets[i] - at);
+        out.write((const char *)sections[i], sizes[i]);
+        at = offsets[i] + sizes[i];
+    }
+    out.write(zeros, total - at);
+    out.close();
+    if (out.fail() || std::rename(tmp.c_str(), cache.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        std::cerr << "Warning: can not write model cache " << cache << std::endl;
+    }
 }
 
 
-bool Model::ray_triangle_intersect(const int &fi, Point &orig, Vector &dir, float &tnear) {
-    Vector edge1 = point(vert(fi,1)) - point(vert(fi,0));
-    Vector edge2 = point(vert(fi,2)) - point(vert(fi,0));
-    Vector pvec = cross(dir, edge2);
-    float det = edge1 * pvec;
+// Moller-Trumbore against the precomputed record, ti is a slot in tris.
+bool Model::ray_triangle_intersect(const int &ti, const Point &orig, const Vector &dir, float &tnear) const {
+    const TriAccel &tri = tris[ti];
+    const Vector &e1 = tri.edge1, &e2 = tri.edge2;
+    float px = dir.y*e2.z - dir.z*e2.y, py = dir.z*e2.x - dir.x*e2.z, pz = dir.x*e2.y - dir.y*e2.x;
+    float det = e1.x*px + e1.y*py + e1.z*pz;
     if (det < 1e-5 && det > -1e-5) return false;
 
-    Vector tvec = orig - point(vert(fi,0));
-    float u = tvec * pvec;
+    float tx = orig.x - tri.v0.x, ty = orig.y - tri.v0.y, tz = orig.z - tri.v0.z;
+    float u = tx*px + ty*py + tz*pz;
     if (u < 0 || u > det) return false;
 
-    Vector qvec = cross(tvec, edge1);
-    float v = dir * qvec;
+    float qx = ty*e1.z - tz*e1.y, qy = tz*e1.x - tx*e1.z, qz = tx*e1.y - ty*e1.x;
+    float v = dir.x*qx + dir.y*qy + dir.z*qz;
     if (v < 0 || u + v > det) return false;
 
-    tnear = edge2 * qvec * (1./det);
+    tnear = (e2.x*qx + e2.y*qy + e2.z*qz) * (1./det);
     return tnear>1e-5;
 }
 
 
+// Closest hit among slots [first, first + count), one packet at a time; returns the slot or -1.
+int Model::intersect_leaf(int first, int count, const Point &orig, const Vector &dir, float &t_max) const {
+    int hit = -1;
+    for (int base = first - first % TRI_PACKET_WIDTH; base < first + count; base += TRI_PACKET_WIDTH) {
+        int lane = tri_packet_intersect(packets[base / TRI_PACKET_WIDTH], orig, dir, std::max(first - base, 0),
+                                        std::min(first + count - base, TRI_PACKET_WIDTH), t_max);
+        if (lane >= 0)
+            hit = base + lane;
+    }
+    return hit;
+}
+
+
+namespace {
+struct TriHit {
+    const Model &model;
+    const Point &orig;
+    const Vector &dir;
+    int tri;
+
+    TriHit(const Model &m, const Point &o, const Vector &d) : model(m), orig(o), dir(d), tri(-1) {}
+    bool operator()(int first, int count, float /*t_min*/, float &t_max) {
+        int ti = model.intersect_leaf(first, count, orig, dir, t_max);
+        if (ti < 0)
+            return false;
+        tri = ti;
+        return true;
+    }
+};
+
+struct TriPacketHit {
+    const Model &model;
+    const RayPacket &rays;
+    int *tri;
+
+    TriPacketHit(const Model &m, const RayPacket &r, int *t) : model(m), rays(r), tri(t) {}
+    bool operator()(int lane, int first, int count, float /*t_min*/, float &t_max) {
+        int ti = model.intersect_leaf(first, count, rays.origin(lane), rays.dir(lane), t_max);
+        if (ti < 0)
+            return false;
+        tri[lane] = ti;
+        return true;
+    }
+};
+}
+
+// Closest triangle hit along the ray, tnear holds the upper bound on input.
+bool Model::intersect(const Point &orig, const Vector &dir, float &tnear, int &tri) const {
+    TriHit hit(*this, orig, dir);
+    if (!bvh.traverse(orig, dir, 1e-5f, tnear, hit))
+        return false;
+    tri = hit.tri;
+    return true;
+}
+
+// Closest triangle hits for a packet, rays.t_max holds the per-lane upper bounds on input.
+// Returns the mask of lanes that hit, tri[lane] is set for those.
+uint64_t Model::intersect_packet(RayPacket &rays, int *tri) const {
+    TriPacketHit hit(*this, rays, tri);
+    return bvh.traverse_packet(rays, 1e-5f, hit);
+}
+
+// Any triangle hit closer than t_max, the traversal stops at the first one.
+bool Model::occluded(const Point &orig, const Vector &dir, float t_max) const {
+    TriHit hit(*this, orig, dir);
+    return bvh.occluded(orig, dir, 1e-5f, t_max, hit);
+}
+
+Vector Model::normal(int ti) const {
+    return tris[ti].normal;
+}
+
+
 int Model::nverts() const {
     return (int)verts.size();
 }
 
 int Model::nfaces() const {
-    return (int)faces.size();
+    return (int)(indices.size() / 3);
 }
 
 void Model::get_bbox(Point &min, Point &max) {
@@ -83,17 +562,7 @@ const Point &Model::point(int i) const {
     return verts[i];
 }
 
-Point &Model::point(int i) {
-    assert(i>=0 && i<nverts());
-    return verts[i];
-}
-
 int Model::vert(int fi, int li) const {
     assert(fi>=0 && fi<nfaces() && li>=0 && li<3);
-    if(li == 0)
-        return (int)faces[fi].x;
-    if(li == 1)
-        return (int)faces[fi].y;
-    if(li == 2)
-        return (int)faces[fi].z;
-}
\ No newline at end of file
+    return (int)indices[3*fi+li];
+}
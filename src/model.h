@@ -4,17 +4,37 @@
 #include <iostream>
 #include <cassert>
 #include <fstream>
-#include <sstream>
 #include <vector>
 #include <string>
 #include "geometry.h"
+#include "bvh.h"
+#include "buffer.h"
+#include "tri_simd.h"
 
 extern std::string MODELS_DIR;
+extern bool mesh_cache;
+
+
+// Triangle prepared for intersection: the first vertex, both edges from it and the unit normal.
+struct TriAccel {
+    Point v0;
+    Vector edge1;
+    Vector edge2;
+    Vector normal;
+};
+
 
 class Model {
 private:
-    std::vector<Point> verts;
-    std::vector<Vector> faces;
+    Buffer<Point> verts;
+    Buffer<uint32_t> indices; // three per face
+    Buffer<TriAccel> tris; // in BVH leaf order, tris[i] is face bvh.prims[i] (-1 for padding)
+    Buffer<TriPacket> packets; // the same slots, TRI_PACKET_WIDTH per packet
+
+    void load_obj(const std::string &path);
+    void build_tris();
+    bool load_cache(const std::string &cache, const std::string &source);
+    void save_cache(const std::string &cache, const std::string &source) const;
 public:
     bool exist;
     Material material;
@@ -24,10 +44,16 @@ public:
     int nverts() const;                          
     int nfaces() const;              
 
-    bool ray_triangle_intersect(const int &fi, Point &orig, Vector &dir, float &tnear);
+    BVH bvh;
+
+    bool ray_triangle_intersect(const int &ti, const Point &orig, const Vector &dir, float &tnear) const;
+    int intersect_leaf(int first, int count, const Point &orig, const Vector &dir, float &t_max) const;
+    bool intersect(const Point &orig, const Vector &dir, float &tnear, int &tri) const;
+    uint64_t intersect_packet(RayPacket &rays, int *tri) const;
+    bool occluded(const Point &orig, const Vector &dir, float t_max) const;
+    Vector normal(int ti) const;
 
     const Point &point(int i) const;
-    Point &point(int i);
     int vert(int fi, int li) const;
     void get_bbox(Point &min, Point &max);
 };
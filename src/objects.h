@@ -2,13 +2,12 @@
 #define OBJECTS_H
 
 
-std::vector<Object*> objects;
-std::vector<Light> lights;
-Color Back_ground(15, 0, 35);
+Scene scene; // as loaded from the scene file, owns the objects
+PrimitiveStore primitives; // scene objects sorted by type, built once per scene by build_scene()
 
 int envmap_width, envmap_height;
 std::vector<Color> envmap;
-Model model;
+MeshStore meshes; // the scene's meshes and their instances
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include <iostream>
+#include <algorithm>
+#include "primitives.h"
+
+
+// Reorders prims into the BVH's leaf order so every leaf is one contiguous run,
+// padding slots (-1) get a value-initialized record.
+template<class T>
+static void to_leaf_order(std::vector<T> &prims, const BVH &bvh)
+{
+    std::vector<T> ordered(bvh.prims.size(), T());
+    for(size_t i = 0; i < ordered.size(); ++i)
+        if(bvh.prims[i] >= 0)
+            ordered[i] = prims[bvh.prims[i]];
+    prims.swap(ordered);
+}
+
+
+void PrimitiveStore::build(const std::vector<Object*> &objects)
+{
+    materials.clear();
+    spheres.clear();
+    planes.clear();
+    triangles.clear();
+    std::vector<AABB> sphere_boxes, triangle_boxes;
+
+    for(Object *obj: objects)
+    {
+        int material = (int)materials.size();
+        materials.push_back(obj->material);
+
+        AABB box;
+        if(Sphere *s = dynamic_cast<Sphere*>(obj))
+        {
+            SpherePrim p = {s->center.x, s->center.y, s->center.z, s->radius, material};
+            s->get_bbox(box.min, box.max);
+            spheres.push_back(p);
+            sphere_boxes.push_back(box);
+        }
+        else if(Plane *s = dynamic_cast<Plane*>(obj))
+        {
+            materials.push_back(s->material_2);
+            PlanePrim p = {s->normal.x, s->normal.y, s->normal.z, s->normal.norm(), s->point.x, s->point.y, s->point.z,
+                           material, material + 1};
+            planes.push_back(p);
+        }
+        else if(Triangle *s = dynamic_cast<Triangle*>(obj))
+        {
+            Vector e1 = s->v1 - s->v0, e2 = s->v2 - s->v0;
+            TrianglePrim p = {s->v0.x, s->v0.y, s->v0.z, e1.x, e1.y, e1.z, e2.x, e2.y, e2.z, material};
+            s->get_bbox(box.min, box.max);
+            triangles.push_back(p);
+            triangle_boxes.push_back(box);
+        }
+        else
+        {
+            materials.pop_back();
+            std::cerr << "Warning: skipping an object of unknown type" << std::endl;
+        }
+    }
+
+    sphere_bvh.build(sphere_boxes, SPHERE_PACKET_WIDTH, 0.25f);
+    sphere_bvh.pad_leaves(SPHERE_PACKET_WIDTH);
+    to_leaf_order(spheres, sphere_bvh);
+    sphere_packets.assign(spheres.size() / SPHERE_PACKET_WIDTH, SpherePacket());
+    for(size_t i = 0; i < spheres.size(); ++i)
+    {
+        SpherePacket &p = sphere_packets[i / SPHERE_PACKET_WIDTH];
+        int lane = i % SPHERE_PACKET_WIDTH;
+        p.cx[lane] = spheres[i].cx;
+        p.cy[lane] = spheres[i].cy;
+        p.cz[lane] = spheres[i].cz;
+        p.r2[lane] = spheres[i].radius * spheres[i].radius;
+    }
+    triangle_bvh.build(triangle_boxes);
+    to_leaf_order(triangles, triangle_bvh);
+}
+
+
+Vector PrimitiveStore::normal(const PrimRef &prim, const Point &P) const
+{
+    switch(prim.type)
+    {
+        case PRIM_SPHERE:
+        {
+            const SpherePrim &s = spheres[prim.index];
+            Vector N = P - Point(s.cx, s.cy, s.cz);
+            return N / N.norm();
+        }
+        case PRIM_PLANE:
+        {
+            const PlanePrim &p = planes[prim.index];
+            return Vector(p.nx, p.ny, p.nz);
+        }
+        case PRIM_TRIANGLE:
+        {
+            const TrianglePrim &t = triangles[prim.index];
+            return cross(Vector(t.e1x, t.e1y, t.e1z), Vector(t.e2x, t.e2y, t.e2z));
+        }
+        default:
+            return Vector();
+    }
+}
+
+const Material &PrimitiveStore::material(const PrimRef &prim, const Point &P) const
+{
+    switch(prim.type)
+    {
+        case PRIM_SPHERE:
+            return materials[spheres[prim.index].material];
+        case PRIM_PLANE:
+        {
+            const PlanePrim &p = planes[prim.index];
+            return materials[(int(0.4*P.x+100) + int(.4*P.z)) & 1 ? p.material : p.material_2];
+        }
+        default:
+            return materials[triangles[prim.index].material];
+    }
+}
+
+
+// Spheres without the padding slots of their packets.
+int PrimitiveStore::nspheres() const {
+    return (int)std::count_if(sphere_bvh.prims.begin(), sphere_bvh.prims.end(), [](int prim) { return prim >= 0; });
+}
+
+int PrimitiveStore::nnodes() const {
+    return sphere_bvh.nnodes() + triangle_bvh.nnodes();
+}
+
+float PrimitiveStore::build_ms() const {
+    return sphere_bvh.build_ms + triangle_bvh.build_ms;
+}
+
+// Both hierarchies are walked for every ray, so their per-ray averages add up.
+float PrimitiveStore::avg_visited() const {
+    return sphere_bvh.avg_visited() + triangle_bvh.avg_visited();
+}
+
+void PrimitiveStore::reset_counters()
+{
+    sphere_bvh.reset_counters();
+    triangle_bvh.reset_counters();
+}
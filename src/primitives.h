@@ -0,0 +1,153 @@
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+#include <vector>
+#include <cmath>
+#include <utility>
+#include "geometry.h"
+#include "bvh.h"
+#include "sphere_simd.h"
+
+extern const float INF;
+
+
+// The scene's Objects compiled into one contiguous array per type, so the render loop
+// intersects them with inlined kernels instead of virtual calls. The kernels return both
+// hits the way the matching Object::IntersectRay does, INF standing for no hit.
+
+enum PrimType {PRIM_NONE, PRIM_SPHERE, PRIM_PLANE, PRIM_TRIANGLE};
+
+struct PrimRef
+{
+    PrimType type;
+    int index;
+
+    PrimRef(): type(PRIM_NONE), index(-1) {}
+    PrimRef(PrimType t, int i): type(t), index(i) {}
+};
+
+
+struct SpherePrim
+{
+    float cx, cy, cz;
+    float radius;
+    int material;
+
+    std::pair<float, float> IntersectRay(const Point &O, const Vector &D) const
+    {
+        float ocx = O.x - cx, ocy = O.y - cy, ocz = O.z - cz;
+        float k1 = D.x*D.x + D.y*D.y + D.z*D.z;
+        float k2 = 2.f * (ocx*D.x + ocy*D.y + ocz*D.z);
+        float k3 = (ocx*ocx + ocy*ocy + ocz*ocz) - radius*radius;
+
+        float discriminant = k2*k2 - 4.f*k1*k3;
+        if(discriminant < 0.f)
+            return std::make_pair(INF, INF);
+
+        double root = std::sqrt((double)discriminant);
+        float t1 = (-k2 + root) / (2.f*k1);
+        float t2 = (-k2 - root) / (2.f*k1);
+        return std::make_pair(t1, t2);
+    }
+};
+
+
+struct PlanePrim
+{
+    float nx, ny, nz;
+    float norm; // length of the normal as given, which is kept unnormalized
+    float px, py, pz;
+    int material;
+    int material_2; // checker squares
+
+    std::pair<float, float> IntersectRay(const Point &O, const Vector &D) const
+    {
+        float d = (D.x*nx + D.y*ny + D.z*nz) / norm;
+        if(std::fabs(d) > 1e-5)
+        {
+            float o = ((O.x - px)*nx + (O.y - py)*ny + (O.z - pz)*nz) / norm;
+            float plane_dist = -(double)o / d;
+            if(plane_dist > 0)
+                return std::make_pair(plane_dist, INF);
+        }
+        return std::make_pair(INF, INF);
+    }
+};
+
+
+struct TrianglePrim
+{
+    float v0x, v0y, v0z;
+    float e1x, e1y, e1z;
+    float e2x, e2y, e2z;
+    int material;
+
+    std::pair<float, float> IntersectRay(const Point &O, const Vector &D) const
+    {
+        float px = D.y*e2z - D.z*e2y, py = D.z*e2x - D.x*e2z, pz = D.x*e2y - D.y*e2x;
+        float det = e1x*px + e1y*py + e1z*pz;
+        if(det < 1e-5 && det > -1e-5) return std::make_pair(INF, INF);
+
+        float tx = O.x - v0x, ty = O.y - v0y, tz = O.z - v0z;
+        float u = tx*px + ty*py + tz*pz;
+        if(u < 0 || u > det) return std::make_pair(INF, INF);
+
+        float qx = ty*e1z - tz*e1y, qy = tz*e1x - tx*e1z, qz = tx*e1y - ty*e1x;
+        float v = D.x*qx + D.y*qy + D.z*qz;
+        if(v < 0 || u + v > det) return std::make_pair(INF, INF);
+
+        float tnear = (e2x*qx + e2y*qy + e2z*qz) * (1./det);
+        return std::make_pair(tnear, INF);
+    }
+};
+
+
+class PrimitiveStore {
+public:
+    std::vector<Material> materials;
+    std::vector<SpherePrim> spheres; // in sphere_bvh leaf order, padded like the sphere packets
+    std::vector<SpherePacket> sphere_packets; // the same slots, SPHERE_PACKET_WIDTH per packet
+    std::vector<PlanePrim> planes; // unbounded, tested on every ray
+    std::vector<TrianglePrim> triangles; // in triangle_bvh leaf order
+    BVH sphere_bvh;
+    BVH triangle_bvh;
+
+    // Sorts objects by type and builds the per-type BVHs, objects of unknown types are skipped.
+    void build(const std::vector<Object*> &objects);
+
+    std::pair<float, float> IntersectRay(const PrimRef &prim, const Point &O, const Vector &D) const
+    {
+        switch(prim.type)
+        {
+            case PRIM_SPHERE: return spheres[prim.index].IntersectRay(O, D);
+            case PRIM_PLANE: return planes[prim.index].IntersectRay(O, D);
+            case PRIM_TRIANGLE: return triangles[prim.index].IntersectRay(O, D);
+            default: return std::make_pair(INF, INF);
+        }
+    }
+    // Nearest sphere hit among slots [first, first + count) with t_min <= t <= t_max, one packet at a time.
+    // Returns the slot and stores its t in t_max, or -1.
+    int intersect_spheres(int first, int count, const Point &O, const Vector &D, float t_min, float &t_max) const
+    {
+        int hit = -1;
+        for(int base = first - first % SPHERE_PACKET_WIDTH; base < first + count; base += SPHERE_PACKET_WIDTH)
+        {
+            int lane = sphere_packet_intersect(sphere_packets[base / SPHERE_PACKET_WIDTH], O, D, std::max(first - base, 0),
+                                               std::min(first + count - base, SPHERE_PACKET_WIDTH), t_min, t_max);
+            if(lane >= 0)
+                hit = base + lane;
+        }
+        return hit;
+    }
+    Vector normal(const PrimRef &prim, const Point &P) const;
+    const Material &material(const PrimRef &prim, const Point &P) const;
+
+    int nspheres() const;
+    int nnodes() const;
+    float build_ms() const;
+    float avg_visited() const;
+    void reset_counters();
+};
+
+
+#endif
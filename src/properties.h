@@ -15,15 +15,24 @@
 
 std::string MODELS_DIR("../models/");
 std::string TEXTURES_DIR("../textures/");
+std::string SCENES_DIR("../scenes/");
 
-int sceneId = 1;
 int threads = 8;
-
-extern const int HEIGHT = 900;
-extern const int WIDTH  = 1600;
+int tile_size = 16;
+int recursion_depth = 3; // reflection/refraction bounces after the primary hit
+float min_ray_weight = 0; // secondary rays with a smaller share of the pixel are culled, 0 traces them all
+bool roulette = false; // Russian roulette instead of culling below min_ray_weight
+int aa_samples = 1; // samples for pixels on edges, 1 turns adaptive anti-aliasing off
+float aa_threshold = 16; // channel difference to a neighbour (of 255) that marks an edge
+int time_budget = 0; // ms for progressive rendering, 0 renders every pixel in one pass
+int packet_size = 4; // primary rays are traced in packet_size x packet_size packets, 1 traces them one by one
+bool mesh_cache = true;
+
+int HEIGHT = 900;
+int WIDTH  = 1600;
 extern const float PI = 3.1415926535;
 extern const float EPSILON = 0.0001;
-extern const int RECURSION_DEPTH = 3;
+extern const int MAX_RECURSION_DEPTH = 62;
 extern const float INF = 10000;
 
 
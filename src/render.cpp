@@ -1,6 +1,15 @@
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include "properties.h"
 #include "geometry.h"
 #include "model.h"
+#include "meshes.h"
+#include "tiles.h"
+#include "primitives.h"
+#include "scene.h"
+#include "stats.h"
+#include "trace.h"
 #include "objects.h"
 
 
@@ -30,53 +39,234 @@ bool RefractRay(Vector &V, Vector &N, float &refractive, Vector &S) {
 }
 
 
-bool ClosestIntersection(Point &O, Vector &D, float t_min, float t_max, Point &P, Vector &N, Material &mat)
+// Closest hit among the primitive store's arrays, PrimType picks the array a BVH leaf indexes.
+struct PrimitiveHit
 {
-    float closest_t = INF;
-    bool Intersection = false;
-    Object* object;
-    for(Object* obj: objects)
+    const Point &O;
+    const Vector &D;
+    PrimRef prim;
+
+    PrimitiveHit(const Point &o, const Vector &d): O(o), D(d) {}
+    // INF stands for a miss and never counts, even while t_max is still INF.
+    bool accept(const std::pair<float, float> &t, const PrimRef &p, float t_min, float &t_max)
     {
-        std::pair<float, float> t = obj->IntersectRay(O, D);
-        if (t.first >= t_min and t.first <= t_max and t.first < closest_t)
+        bool hit = false;
+        if (t.first >= t_min and t.first < INF and t.first <= t_max and (prim.type == PRIM_NONE or t.first < t_max))
         {
-            closest_t = t.first;
-            Intersection = true;
-            object = obj;
+            t_max = t.first;
+            prim = p;
+            hit = true;
         }
-        if (t.second >= t_min and t.second <= t_max and t.second < closest_t)
+        if (t.second >= t_min and t.second < INF and t.second <= t_max and (prim.type == PRIM_NONE or t.second < t_max))
         {
-            closest_t = t.second;
-            Intersection = true;
-			object = obj;      
+            t_max = t.second;
+            prim = p;
+            hit = true;
         }
+        return hit;
+    }
+    template<PrimType type>
+    bool test(int first, int count, float t_min, float &t_max)
+    {
+        bool hit = false;
+        for(int i = first; i < first + count; ++i)
+            hit = accept(primitives.IntersectRay(PrimRef(type, i), O, D), PrimRef(type, i), t_min, t_max) || hit;
+        return hit;
+    }
+};
+
+// Spheres go through the packet kernel, which already yields the nearest root in range.
+template<>
+bool PrimitiveHit::test<PRIM_SPHERE>(int first, int count, float t_min, float &t_max)
+{
+    float t = t_max;
+    int i = primitives.intersect_spheres(first, count, O, D, t_min, t);
+    if(i < 0 or (prim.type != PRIM_NONE and t >= t_max))
+        return false;
+    t_max = t;
+    prim = PrimRef(PRIM_SPHERE, i);
+    return true;
+}
+
+template<PrimType type>
+struct LeafHit
+{
+    PrimitiveHit &hit;
+
+    LeafHit(PrimitiveHit &h): hit(h) {}
+    bool operator()(int first, int count, float t_min, float &t_max)
+    {
+        return hit.test<type>(first, count, t_min, t_max);
+    }
+};
+
+
+// Shadow ray hit: any primitive point inside the environment sphere blocks the light.
+struct OcclusionHit
+{
+    const Point &O;
+    const Vector &D;
+    float refractive_index;
+
+    OcclusionHit(const Point &o, const Vector &d): O(o), D(d), refractive_index(0) {}
+    bool blocks(const PrimRef &prim, float t)
+    {
+        Point P = D.to_point(t) + O;
+        if((Point(0,0,0) - P).norm() >= 95)
+            return false;
+        refractive_index = primitives.material(prim, P).refractive_index;
+        return true;
+    }
+    template<PrimType type>
+    bool test(int first, int count, float t_min, float t_max)
+    {
+        for(int i = first; i < first + count; ++i)
+        {
+            std::pair<float, float> t = primitives.IntersectRay(PrimRef(type, i), O, D);
+            if((t.first >= t_min and t.first <= t_max and blocks(PrimRef(type, i), t.first)) or
+               (t.second >= t_min and t.second <= t_max and blocks(PrimRef(type, i), t.second)))
+                return true;
+        }
+        return false;
+    }
+};
+
+// The nearest sphere hit settles it unless that point is outside the blocking range,
+// then the leaf is checked sphere by sphere.
+template<>
+bool OcclusionHit::test<PRIM_SPHERE>(int first, int count, float t_min, float t_max)
+{
+    float t = t_max;
+    int i = primitives.intersect_spheres(first, count, O, D, t_min, t);
+    if(i < 0)
+        return false;
+    if(blocks(PrimRef(PRIM_SPHERE, i), t))
+        return true;
+    for(i = first; i < first + count; ++i)
+    {
+        std::pair<float, float> ts = primitives.spheres[i].IntersectRay(O, D);
+        if((ts.first >= t_min and ts.first <= t_max and blocks(PrimRef(PRIM_SPHERE, i), ts.first)) or
+           (ts.second >= t_min and ts.second <= t_max and blocks(PrimRef(PRIM_SPHERE, i), ts.second)))
+            return true;
     }
+    return false;
+}
 
-    if(Intersection)
+template<PrimType type>
+struct LeafOcclusion
+{
+    OcclusionHit &hit;
+
+    LeafOcclusion(OcclusionHit &h): hit(h) {}
+    bool operator()(int first, int count, float t_min, float &t_max)
     {
+        return hit.test<type>(first, count, t_min, t_max);
+    }
+};
+
+
+// Per-thread ray counters, padded to a cache line like BVHCounter. Sphere and triangle
+// tests are counted by their BVHs, planes are tested outside of any.
+struct RayCounter
+{
+    uint64_t primary;
+    uint64_t reflection;
+    uint64_t refraction;
+    uint64_t shadow;
+    uint64_t culled; // secondary rays dropped for a weight below min_ray_weight
+    uint64_t rescued; // below min_ray_weight but kept by Russian roulette
+    uint64_t plane_tests;
+    char pad[8];
+};
+
+std::vector<RayCounter> ray_counters(BVH_COUNTER_SLOTS);
+
+static RayCounter &ray_counter()
+{
+    return ray_counters[omp_get_thread_num() % BVH_COUNTER_SLOTS];
+}
+
+static uint64_t TracedRays(const RayCounter &c)
+{
+    return c.primary + c.reflection + c.refraction + c.shadow;
+}
+
+// Rays traced per pixel for the heatmap, NULL when render() was not asked for one.
+static uint32_t *pixel_rays = NULL;
+
+// Charges pixel i with the rays the thread traced since its count stood at since.
+static void ChargePixel(int i, const RayCounter &counter, uint64_t since)
+{
+    if(pixel_rays)
+        pixel_rays[i] += (uint32_t)(TracedRays(counter) - since);
+}
+
+
+void BuildAcceleration()
+{
+    std::vector<Object*> objects;
+    for(const std::unique_ptr<Object> &obj: scene.objects)
+        objects.push_back(obj.get());
+    primitives.build(objects);
+    std::cout << "Primitives: " << primitives.nspheres() << " spheres, " << primitives.planes.size() << " planes, "
+              << primitives.triangles.size() << " triangles, BVHs of " << primitives.nnodes() << " nodes built in "
+              << primitives.build_ms() << " ms" << std::endl;
+}
+
+
+// Closest primitive along the ray within [t_min, t_max], t_max shrinks to its distance.
+PrimRef ClosestPrimitive(const Point &O, const Vector &D, float t_min, float &t_max)
+{
+    PrimitiveHit hit(O, D);
+    LeafHit<PRIM_SPHERE> spheres(hit);
+    LeafHit<PRIM_TRIANGLE> triangles(hit);
+    primitives.sphere_bvh.traverse(O, D, t_min, t_max, spheres);
+    primitives.triangle_bvh.traverse(O, D, t_min, t_max, triangles);
+    hit.test<PRIM_PLANE>(0, (int)primitives.planes.size(), t_min, t_max);
+    ray_counter().plane_tests += primitives.planes.size();
+    return hit.prim;
+}
+
+
+// Identifies what a primary ray hit, for edge detection: 0 for nothing, meshes by instance.
+#define MESH_ID 0xF0000000u
+
+static uint32_t PrimId(const PrimRef &prim)
+{
+    return prim.type == PRIM_NONE ? 0 : ((uint32_t)prim.type << 28) | (uint32_t)prim.index;
+}
+
+
+bool ClosestIntersection(Point &O, Vector &D, float t_min, float t_max, Point &P, Vector &N, Material &mat, uint32_t *id = NULL)
+{
+    PrimRef prim = ClosestPrimitive(O, D, t_min, t_max);
+    if(id)
+        *id = PrimId(prim);
+
+    float closest_t = INF;
+    bool Intersection = false;
+    if(prim.type != PRIM_NONE)
+    {
+        closest_t = t_max;
+        Intersection = true;
         P = D.to_point(closest_t) + O;
-        N = object->get_normal(P);
-        mat = object->get_material(P);
+        N = primitives.normal(prim, P);
+        mat = primitives.material(prim, P);
     }
 
-    if(model.exist)
+    if(!meshes.empty())
     {
-        float model_dist = INF;
-        for (int t=0; t<model.nfaces(); t++)
+        int instance, tri;
+        float dist = closest_t;
+        if(meshes.intersect(O, D, dist, instance, tri))
         {
-            float dist;
-            if (model.ray_triangle_intersect(t, O, D, dist) && dist < closest_t)
-            {
-                Intersection = true;
-                closest_t = dist;
-                P = D.to_point(closest_t) + O;
-                Point v0 = model.point(model.vert(t, 0));
-                Point v1 = model.point(model.vert(t, 1));
-                Point v2 = model.point(model.vert(t, 2));
-                N = cross(v1-v0, v2-v0);
-                N = N / N.norm();
-                mat = model.material;
-            }
+            Intersection = true;
+            closest_t = dist;
+            P = D.to_point(closest_t) + O;
+            N = meshes.normal(instance, tri);
+            mat = meshes.instances[instance].material;
+            if(id)
+                *id = MESH_ID | instance;
         }
     }
 
@@ -84,10 +274,119 @@ bool ClosestIntersection(Point &O, Vector &D, float t_min, float t_max, Point &P
 }
 
 
+// Closest primitive per lane of a packet.
+struct PacketPrimitiveHit
+{
+    const RayPacket &rays;
+    PrimRef prim[BVH_PACKET_MAX];
+
+    PacketPrimitiveHit(const RayPacket &r): rays(r) {}
+    template<PrimType type>
+    bool test(int lane, int first, int count, float t_min, float &t_max)
+    {
+        Point O = rays.origin(lane);
+        Vector D = rays.dir(lane);
+        PrimitiveHit hit(O, D);
+        hit.prim = prim[lane];
+        bool found = hit.test<type>(first, count, t_min, t_max);
+        prim[lane] = hit.prim;
+        return found;
+    }
+};
+
+template<PrimType type>
+struct PacketLeafHit
+{
+    PacketPrimitiveHit &hit;
+
+    PacketLeafHit(PacketPrimitiveHit &h): hit(h) {}
+    bool operator()(int lane, int first, int count, float t_min, float &t_max)
+    {
+        return hit.test<type>(lane, first, count, t_min, t_max);
+    }
+};
+
+// Packet counterpart of ClosestIntersection for rays sharing t_min: hits[lane] says whether
+// the lane hit anything, P, N, mat and id are filled for those lanes.
+void ClosestIntersectionPacket(RayPacket &rays, float t_min, bool *hits, Point *P, Vector *N, Material *mat, uint32_t *id)
+{
+    PacketPrimitiveHit hit(rays);
+    PacketLeafHit<PRIM_SPHERE> spheres(hit);
+    PacketLeafHit<PRIM_TRIANGLE> triangles(hit);
+    primitives.sphere_bvh.traverse_packet(rays, t_min, spheres);
+    primitives.triangle_bvh.traverse_packet(rays, t_min, triangles);
+    if(!primitives.planes.empty())
+        for(int lane = 0; lane < rays.size; ++lane)
+            hit.test<PRIM_PLANE>(lane, 0, (int)primitives.planes.size(), t_min, rays.t_max[lane]);
+    ray_counter().plane_tests += primitives.planes.size() * rays.size;
+
+    for(int lane = 0; lane < rays.size; ++lane)
+    {
+        hits[lane] = hit.prim[lane].type != PRIM_NONE;
+        id[lane] = PrimId(hit.prim[lane]);
+        if(hits[lane])
+        {
+            P[lane] = rays.dir(lane).to_point(rays.t_max[lane]) + rays.origin(lane);
+            N[lane] = primitives.normal(hit.prim[lane], P[lane]);
+            mat[lane] = primitives.material(hit.prim[lane], P[lane]);
+        }
+        else
+            rays.t_max[lane] = INF;
+    }
+
+    if(!meshes.empty())
+    {
+        int instance[BVH_PACKET_MAX], tri[BVH_PACKET_MAX];
+        uint64_t found = meshes.intersect_packet(rays, instance, tri);
+        for(; found; found &= found - 1)
+        {
+            int lane = ctz64(found);
+            hits[lane] = true;
+            P[lane] = rays.dir(lane).to_point(rays.t_max[lane]) + rays.origin(lane);
+            N[lane] = meshes.normal(instance[lane], tri[lane]);
+            mat[lane] = meshes.instances[instance[lane]].material;
+            id[lane] = MESH_ID | instance[lane];
+        }
+    }
+}
+
+
+// Any-hit query for shadow rays, refractive_index is the transparency of the occluder found.
+bool Occluded(Point &O, Vector &D, float t_min, float t_max, float &refractive_index)
+{
+    RayCounter &counter = ray_counter();
+    counter.shadow++;
+    OcclusionHit hit(O, D);
+    LeafOcclusion<PRIM_SPHERE> spheres(hit);
+    LeafOcclusion<PRIM_TRIANGLE> triangles(hit);
+    bool blocked = primitives.sphere_bvh.occluded(O, D, t_min, t_max, spheres) ||
+                   primitives.triangle_bvh.occluded(O, D, t_min, t_max, triangles);
+    if(!blocked && !primitives.planes.empty())
+    {
+        counter.plane_tests += primitives.planes.size();
+        blocked = hit.test<PRIM_PLANE>(0, (int)primitives.planes.size(), t_min, t_max);
+    }
+    if(blocked)
+    {
+        refractive_index = hit.refractive_index;
+        return true;
+    }
+
+    // Meshes have always occluded along the whole ray, not only up to t_max.
+    int instance;
+    if(!meshes.empty() && meshes.occluded(O, D, INF, instance))
+    {
+        refractive_index = meshes.instances[instance].material.refractive_index;
+        return true;
+    }
+    return false;
+}
+
+
 std::pair<float, float> ComputeLighting(Point &P, Vector &N, Vector &V, int specular, float specular_index)
 {
     float d = 0.0, s = 0.0;
-    for(Light & l : lights)
+    for(Light & l : scene.lights)
     {
         if (l.type == 0)
             d += l.intensity;
@@ -106,19 +405,16 @@ std::pair<float, float> ComputeLighting(Point &P, Vector &N, Vector &V, int spec
                 t_max = INF;
             }
 
-           
-    		Material mat;
-            Point P_2;
-            Vector N_2;
-            if(ClosestIntersection(P, L, EPSILON, t_max, P_2, N_2, mat) && (Point(0,0,0) - P_2).norm() < 95){
+            float transparency;
+            if(Occluded(P, L, EPSILON, t_max, transparency)){
                 float k = (N * L)/(N.norm()*L.norm());
-                d += l.intensity * std::max(0.f, k) * mat.refractive_index;
+                d += l.intensity * std::max(0.f, k) * transparency;
                 if (specular != -1)
                 {
                     Vector R = ReflectRay(L, N);
                     k = (R * V)/(R.norm() * V.norm());
                     if (k > 0.f)
-                        s += l.intensity * specular_index * pow(k , specular) * mat.refractive_index;
+                        s += l.intensity * specular_index * pow(k , specular) * transparency;
                 }
                 continue;
             }
@@ -141,235 +437,539 @@ std::pair<float, float> ComputeLighting(Point &P, Vector &N, Vector &V, int spec
 }
 
 
-Color TraceRay(Point &O, Vector &D, float t_min, float t_max, int depth)
+// Secondary ray waiting on the trace stack, weight is its share of the pixel.
+struct RayTask
 {
-    Material mat;
-    Point P;
-    Vector N;
+    Point O;
+    Vector D;
+    float weight;
+    int depth;
+};
+
+// Random number in [0, 1) hashed from the ray itself, so roulette decisions do not depend
+// on which thread traces the pixel or when.
+static float RayRandom(const Point &O, const Vector &D)
+{
+    uint32_t bits[6];
+    float v[6] = {O.x, O.y, O.z, D.x, D.y, D.z};
+    memcpy(bits, v, sizeof(bits));
+    uint32_t h = 2166136261u;
+    for(uint32_t b: bits)
+        h = (h ^ b) * 16777619u;
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    return (h >> 8) * (1.f / 16777216);
+}
 
-    if(!ClosestIntersection(O, D, t_min, t_max, P, N, mat))
-        return Back_ground;
+
+// Whether a secondary ray of the given weight is worth tracing. Below min_ray_weight it is
+// dropped, which trades a small bias for speed, or with roulette on survives with
+// probability weight / min_ray_weight carrying min_ray_weight, which keeps the mean.
+static bool KeepRay(const Point &O, const Vector &D, float &weight, RayCounter &counter, uint64_t &traced)
+{
+    if(weight >= min_ray_weight)
+    {
+        traced++;
+        return true;
+    }
+    if(roulette && RayRandom(O, D) * min_ray_weight < weight)
+    {
+        weight = min_ray_weight;
+        counter.rescued++;
+        traced++;
+        return true;
+    }
+    counter.culled++;
+    return false;
+}
+
+
+// Room for every ray still pending in a depth-first walk of the ray tree: at most one
+// sibling per level plus the two children of the deepest hit.
+#define RAY_STACK_SIZE (MAX_RECURSION_DEPTH + 2)
+
+
+// Adds the local shading of the hit at P, seen along D, to L and pushes its reflected
+// and refracted rays unless their weight is negligible.
+void ShadeHit(Vector &D, Point &P, Vector &N, Material &mat, float weight, int depth, Radiance &L, RayTask *stack, int &sp)
+{
     if((Point(0,0,0) - P).norm() > 95)
     {
         if(envmap.size())
         {
             int a = (atan2(P.z, P.x) / (2*PI) + .5) * envmap_width;
             int b = acos(P.y / 100) / PI * envmap_height;
-            return envmap[a+b*envmap_width];
+            L += Radiance(envmap[a+b*envmap_width]) * weight;
         }
-        return Back_ground;
+        else
+            L += Radiance(scene.background) * weight;
+        return;
     }
 
     Vector V = D * (-1.f);
 
     std::pair<float, float> light = ComputeLighting(P, N, V, mat.specular, mat.specular_index);
-    Color local_color = mat.color * light.first;
-    
+    float specular = 255 * light.second * weight;
+    L += Radiance(specular, specular, specular);
+
     if(depth <= 0)
-    	return local_color + Color(255,255,255) * light.second;
+    {
+        L += Radiance(mat.color) * (light.first * weight);
+        return;
+    }
 
     float h = mat.refractive_index;
     float r = std::min(1 - h, mat.reflective);
 
-    local_color = local_color * (1 - h - r);
+    L += Radiance(mat.color) * (light.first * (1 - h - r) * weight);
 
+    RayCounter &counter = ray_counter();
     if(r > 0)
     {
-        Vector R = ReflectRay(V, N);
-        local_color = local_color + TraceRay(P, R, EPSILON, INF, depth - 1) * r;
+        RayTask &task = stack[sp];
+        task.O = P;
+        task.D = ReflectRay(V, N);
+        task.weight = r * weight;
+        task.depth = depth - 1;
+        if(KeepRay(task.O, task.D, task.weight, counter, counter.reflection))
+            sp++;
     }
-    
-    if(h > 0)
+
+    Vector S(0,0,0);
+    if(h > 0 && RefractRay(D, N, mat.refractive, S))
     {
-        Vector S(0,0,0);
-        if(RefractRay(D, N, mat.refractive, S))
-            local_color = local_color + TraceRay(P, S, EPSILON, INF, depth - 1) * h;
+        RayTask &task = stack[sp];
+        task.O = P;
+        task.D = S;
+        task.weight = h * weight;
+        task.depth = depth - 1;
+        if(KeepRay(task.O, task.D, task.weight, counter, counter.refraction))
+            sp++;
     }
+}
+
 
-    return local_color + Color(255,255,255) * light.second;
+// Traces the pending secondary rays depth first until the stack is empty.
+void TraceStack(Radiance &L, RayTask *stack, int sp)
+{
+    Material mat;
+    Point P;
+    Vector N;
+    while(sp)
+    {
+        RayTask task = stack[--sp];
+        if(ClosestIntersection(task.O, task.D, EPSILON, INF, P, N, mat))
+            ShadeHit(task.D, P, N, mat, task.weight, task.depth, L, stack, sp);
+        else
+            L += Radiance(scene.background) * task.weight;
+    }
 }
 
 
+// Radiance seen along D from the hit point P, with up to depth further bounces.
+Radiance ShadeHit(Vector &D, Point &P, Vector &N, Material &mat, int depth)
+{
+    RayTask stack[RAY_STACK_SIZE];
+    int sp = 0;
+    Radiance L;
+    ShadeHit(D, P, N, mat, 1.f, depth, L, stack, sp);
+    TraceStack(L, stack, sp);
+    return L;
+}
+
 
-void render(std::vector<uint32_t> &image, Camera &camera)
+Radiance TraceRay(Point &O, Vector &D, float t_min, float t_max, int depth)
 {
-	omp_set_num_threads(threads);
-    std::cout << "Threads: " << threads << std::endl;
-	
-	for(int i = (-1)*HEIGHT/2; i < HEIGHT/2; ++i)
-	{
-        if((i+HEIGHT/2)%(HEIGHT/10) == 0)
-            std::cout << "\rProgress: " <<  (i+HEIGHT/2)/(HEIGHT/100) << "%" << std::flush;
-        #pragma omp parallel for
-    	for(int j = (-1)*WIDTH/2; j < WIDTH/2; ++j)
-    	{
-        	Vector D = camera.point_to_vector(i, j);
-        	Color color = TraceRay(camera.O, D, 1, INF, RECURSION_DEPTH);
-        	image[(i+HEIGHT/2)*WIDTH + (j+WIDTH/2)] = (color).hex();
-    	}
-	}
-    std::cout << "\rProgress: 100%\n";
+    Material mat;
+    Point P;
+    Vector N;
 
-   return;
+    if(!ClosestIntersection(O, D, t_min, t_max, P, N, mat))
+        return Radiance(scene.background);
+    return ShadeHit(D, P, N, mat, depth);
 }
 
 
-bool build_image(std::vector<uint32_t> &image, int sceneId)
+// Primary rays of a tile, packet_size x packet_size pixels at a time, into frame and the
+// primary hit ids. Hits are found for the whole packet, shading and secondary rays then go
+// on per pixel.
+void RenderTile(std::vector<Radiance> &frame, std::vector<uint32_t> &ids, Camera &camera, const Tile &tile)
 {
+    Material mat[BVH_PACKET_MAX];
+    Point P[BVH_PACKET_MAX];
+    Vector N[BVH_PACKET_MAX];
+    RayCounter &counter = ray_counter();
+    if(packet_size == 1)
+    {
+        for(int y = tile.y0; y < tile.y1; ++y)
+            for(int x = tile.x0; x < tile.x1; ++x)
+            {
+                uint64_t since = TracedRays(counter);
+                counter.primary++;
+                Vector D = camera.point_to_vector(y - HEIGHT/2, x - WIDTH/2);
+                bool hit = ClosestIntersection(camera.O, D, 1, INF, P[0], N[0], mat[0], &ids[y*WIDTH + x]);
+                frame[y*WIDTH + x] = hit ? ShadeHit(D, P[0], N[0], mat[0], recursion_depth) : Radiance(scene.background);
+                ChargePixel(y*WIDTH + x, counter, since);
+            }
+        return;
+    }
 
-	switch(sceneId)
-	{
-		case 1:
-		{
-            std::cout << "Scene 1" << std::endl;
+    bool hits[BVH_PACKET_MAX];
+    uint32_t id[BVH_PACKET_MAX];
+    int pixel[BVH_PACKET_MAX];
+    for(int py = tile.y0; py < tile.y1; py += packet_size)
+        for(int px = tile.x0; px < tile.x1; px += packet_size)
+        {
+            RayPacket rays;
+            for(int y = py; y < std::min(py + packet_size, tile.y1); ++y)
+                for(int x = px; x < std::min(px + packet_size, tile.x1); ++x)
+                {
+                    pixel[rays.size] = y*WIDTH + x;
+                    rays.add(camera.O, camera.point_to_vector(y - HEIGHT/2, x - WIDTH/2), INF);
+                }
 
-            Back_ground = Color(15, 0, 35);
+            ClosestIntersectionPacket(rays, 1, hits, P, N, mat, id);
+            counter.primary += rays.size;
+            for(int lane = 0; lane < rays.size; ++lane)
+            {
+                uint64_t since = TracedRays(counter) - 1; // the lane's primary ray, counted with the packet
+                Vector D = rays.dir(lane);
+                frame[pixel[lane]] = hits[lane] ? ShadeHit(D, P[lane], N[lane], mat[lane], recursion_depth) : Radiance(scene.background);
+                ids[pixel[lane]] = id[lane];
+                ChargePixel(pixel[lane], counter, since);
+            }
+        }
+}
+
+
+// Largest difference of the displayed (clamped) channels of two pixels.
+static float Contrast(const Radiance &a, const Radiance &b)
+{
+    float dr = std::fabs(std::min(255.f, a.r) - std::min(255.f, b.r));
+    float dg = std::fabs(std::min(255.f, a.g) - std::min(255.f, b.g));
+    float db = std::fabs(std::min(255.f, a.b) - std::min(255.f, b.b));
+    return std::max(dr, std::max(dg, db));
+}
+
+// Pixels on an object boundary or with more than aa_threshold contrast to a 4-neighbour.
+static std::vector<char> FindEdges(const std::vector<Radiance> &frame, const std::vector<uint32_t> &ids)
+{
+    std::vector<char> edges(frame.size(), 0);
+    #pragma omp parallel for schedule(dynamic, 16)
+    for(int y = 0; y < HEIGHT; ++y)
+        for(int x = 0; x < WIDTH; ++x)
+        {
+            int i = y*WIDTH + x;
+            const int neighbours[4] = {x > 0 ? i - 1 : i, x + 1 < WIDTH ? i + 1 : i, y > 0 ? i - WIDTH : i, y + 1 < HEIGHT ? i + WIDTH : i};
+            for(int n: neighbours)
+                if(ids[n] != ids[i] || Contrast(frame[n], frame[i]) > aa_threshold)
+                {
+                    edges[i] = 1;
+                    break;
+                }
+        }
+    return edges;
+}
 
-            int n = -1;
-            unsigned char *data = stbi_load((TEXTURES_DIR + "space.jpg").c_str(), &envmap_width, &envmap_height, &n, 0);
-            if (!data || 3!=n) {
-                std::cerr << "Error: can not load the environment map" << std::endl;
-                return -1;
+// Averages the existing center sample of every edge pixel in the tile with aa_samples - 1
+// more, placed on the 2D golden-ratio (R2) sequence so any count covers the pixel evenly.
+void SupersampleTile(std::vector<Radiance> &frame, const std::vector<char> &edges, Camera &camera, const Tile &tile)
+{
+    RayCounter &counter = ray_counter();
+    for(int y = tile.y0; y < tile.y1; ++y)
+        for(int x = tile.x0; x < tile.x1; ++x)
+        {
+            int i = y*WIDTH + x;
+            if(!edges[i])
+                continue;
+            Radiance sum = frame[i];
+            uint64_t since = TracedRays(counter);
+            counter.primary += aa_samples - 1;
+            for(int n = 1; n < aa_samples; ++n)
+            {
+                float ox = n * 0.7548776662f, oy = n * 0.5698402910f;
+                ox -= floorf(ox);
+                oy -= floorf(oy);
+                Vector D = camera.point_to_vector(y - HEIGHT/2 + oy - 0.5f, x - WIDTH/2 + ox - 0.5f);
+                sum += TraceRay(camera.O, D, 1, INF, recursion_depth);
             }
-            envmap = std::vector<Color>(envmap_width*envmap_height);
-            for (int j = 0; j<envmap_height; j++)
-                for (int i = 0; i<envmap_width; i++)
-                    envmap[i+j*envmap_width] = Color(data[(i+j*envmap_width)*3+0], data[(i+j*envmap_width)*3+1], data[(i+j*envmap_width)*3+2]) * 0.4;
-            stbi_image_free(data);
-            Sphere env(Point(0, 0, 0), 100, Material());
-
-            Material glass(Color(200,200,200), 200, 0.8, 0.2, 0.8, 4);
-            Material red(Color(200,20,0), 2, 0.1, 0.04, 0, 1);
-            Material mirror(Color(100,100,100), 800, 2, 0.8, 0, 1);
-            Material green(Color(40,150,30), 200, 0.2, 0.3, 0, 1);
-            Material pastel(Color(215,130,80), 600, 1, 0.2, 0, 1);
-
-		    Sphere sphere1(Point(0, 0, 17), 4, glass);
-		    Sphere sphere2(Point(-10, -11, 17), 10, mirror);
-		    Sphere sphere3(Point(-10, 10, 34), 16, red);
-            Sphere sphere4(Point(15, 10, 31), 15, green);
-            Sphere sphere5(Point(5, -5, 11), 3, pastel);
-
-            objects.push_back(&env);
-            objects.push_back(&sphere1);
-            objects.push_back(&sphere2);
-            objects.push_back(&sphere3);
-            objects.push_back(&sphere4);
-            objects.push_back(&sphere5);
-
-		    lights.push_back(Light(1, 0.8, Point(15,10,0)));
-            lights.push_back(Light(1, 0.3, Point(0,10,5)));
-		    lights.push_back(Light(2, 0.2, Vector(1,1,-5)));
-		    lights.push_back(Light(0, 0.05));
-
-
-		    Camera camera(Point(0,0,-7), Vector(0,0,1), 60);
-
-		    render(image, camera);
-
-		    return true;
-		}
-		case 2:
-		{
-            std::cout << "Scene 2" << std::endl;
-
-            Back_ground = Color(200, 197, 230);
-
-            Material red_glass(Color(240,40,10), 600, 0.6, 0.04, 0.75, 4);
-            Material green_glass(Color(10,100,20), 600, 0.6, 0.05, 0.6, 1.5);
-            Material dark_mirror(Color(10,60,70), 700, 0.8, 0.5, 0, 1);
-            Material pastel(Color(170, 125, 80), 0.4, 0.02, 0, 0, 1);
-            Material dark_pastel(Color(145, 90, 40), 0.5, 0.05, 0, 0, 1);
-            Material lamp(Color(255, 255, 255), 10, 1, 0, 0, 1);
-
-            Sphere sphere1(Point(6, -2, 12), 5, red_glass);
-            Sphere sphere2(Point(-8, -4, 17), 3, dark_mirror);
-            Plane plane1(Vector(0, 0, -1), Point(0, 0, 20), pastel, pastel);
-            Plane plane2(Vector(-1, 0, 0), Point(11, 0, 0), pastel, pastel);
-            Plane plane3(Vector(0, -1, 0), Point(0, 7, 0), dark_pastel, pastel);
-            Plane plane4(Vector(1, 0, 0), Point(-11, 0, 0), pastel, pastel);
-            Plane plane5(Vector(0, 1, 0), Point(0, -7, 0), dark_pastel, pastel);
-            Plane plane6(Vector(0, 0, 1), Point(0, 0, -11), pastel, pastel);
-            Triangle triangle1(Point(-2, -7, 8), Point(-3, -1, 12), Point(0, -7, 13), green_glass);
-            Triangle triangle2(Point(-2, -7, 8), Point(-3, -1, 12), Point(-6, -7, 10), green_glass);
-            Triangle triangle3(Point(-6, -7, 10), Point(-3, -1, 12), Point(0, -7, 13), green_glass);
-            Triangle triangle4(Point(-3, -1, 12), Point(-2, -7, 8), Point(0, -7, 13), green_glass);
-            Triangle triangle5(Point(-3, -1, 12), Point(-2, -7, 8), Point(-6, -7, 10), green_glass);
-            Triangle triangle6(Point(-3, -1, 12), Point(-6, -7, 10), Point(0, -7, 13), green_glass);
-
-		    objects.push_back(&sphere1);
-            objects.push_back(&sphere2);
-            objects.push_back(&plane1);
-            objects.push_back(&plane2);
-            objects.push_back(&plane3);
-            objects.push_back(&plane4);
-            objects.push_back(&plane5);
-            objects.push_back(&plane6);
-            objects.push_back(&triangle1);
-            objects.push_back(&triangle2);
-            objects.push_back(&triangle3);
-            objects.push_back(&triangle4);
-            objects.push_back(&triangle5);
-            objects.push_back(&triangle6);
-
-		    lights.push_back(Light(1, 0.4, Point(0,2,15)));
-            lights.push_back(Light(1, 0.4, Point(0,2,-5)));
-		    lights.push_back(Light(0, 0.2));
-
-		    Camera camera(Point(0,0,-10), Vector(0,0,1), 70);
-
-		    render(image, camera);
-
-			return true;
-		}
-		case 3:
-		{
-            std::cout << "Scene 3" << std::endl;
+            frame[i] = sum * (1.f / aa_samples);
+            ChargePixel(i, counter, since);
+        }
+}
+
 
-            Back_ground = Color(200, 200, 200);
+// Runs work over every tile of the frame on all threads, reporting progress under label.
+// Tiles not started by the deadline are skipped; returns whether every tile was done.
+template<class Work>
+bool RenderPass(const char *label, Work work,
+                std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max())
+{
+    TileScheduler scheduler(WIDTH, HEIGHT, tile_size, threads);
+    int total = scheduler.ntiles();
+    std::atomic<int> done(0);
+    bool tracing = TraceEnabled();
+    TraceTime pass_start = std::chrono::steady_clock::now();
 
-            int n = -1;
-            unsigned char *data = stbi_load((TEXTURES_DIR + "space.jpg").c_str(), &envmap_width, &envmap_height, &n, 0);
-            if (!data || 3!=n)
+    #pragma omp parallel
+    {
+        int index;
+        while(std::chrono::steady_clock::now() < deadline && scheduler.next(omp_get_thread_num(), index))
+        {
+            Tile tile = scheduler.tile(index);
+            TraceTime tile_start = tracing ? std::chrono::steady_clock::now() : TraceTime();
+            work(tile);
+            if(tracing)
+                TraceSpan(label, "tile", tile_start, std::chrono::steady_clock::now(),
+                          "\"tile\": " + std::to_string(index) + ", \"x\": " + std::to_string(tile.x0) + ", \"y\": " + std::to_string(tile.y0));
+
+            int finished = ++done;
+            if(finished < total && finished*10/total != (finished-1)*10/total)
             {
-                std::cerr << "Error: can not load the environment map" << std::endl;
-                return -1;
+                #pragma omp critical
+                std::cout << "\r" << label << ": " << finished*100/total << "%" << std::flush;
             }
-            envmap = std::vector<Color>(envmap_width*envmap_height);
-            for (int j = 0; j<envmap_height; j++)
-                for (int i = 0; i<envmap_width; i++)
-                    envmap[i+j*envmap_width] = Color(data[(i+j*envmap_width)*3+0], data[(i+j*envmap_width)*3+1], data[(i+j*envmap_width)*3+2]) * 0.5;
-            stbi_image_free(data);
-            Sphere env(Point(0, 0, 0), 100, Material());
+        }
+    }
+    std::cout << "\r" << label << ": " << done*100/total << "%\n";
+    TraceSpan(label, "pass", pass_start, std::chrono::steady_clock::now());
+    return done == total;
+}
 
-            model = Model("rocket.obj");
-            model.material = Material(Color(255, 255, 255), 10, 0.5, 0, 0, 1);
 
-            Material window(Color(10,60,70), 500, 1, 0.3, 0, 1);
+// One level of progressive rendering: the pixels on a grid of the given step, anchored at
+// the tile's corner, each filling its step x step block until a finer level replaces it.
+// Grid points of the coarser level (every second one) are skipped unless this is the first.
+void RenderTileLevel(std::vector<Radiance> &frame, std::vector<uint32_t> &ids, Camera &camera, const Tile &tile, int step, bool first)
+{
+    Material mat;
+    Point P;
+    Vector N;
+    RayCounter &counter = ray_counter();
+    for(int y = tile.y0; y < tile.y1; y += step)
+        for(int x = tile.x0; x < tile.x1; x += step)
+        {
+            if(!first && (y - tile.y0) % (2*step) == 0 && (x - tile.x0) % (2*step) == 0)
+                continue;
+            uint64_t since = TracedRays(counter);
+            counter.primary++;
+            Vector D = camera.point_to_vector(y - HEIGHT/2, x - WIDTH/2);
+            uint32_t id;
+            Radiance L = ClosestIntersection(camera.O, D, 1, INF, P, N, mat, &id) ? ShadeHit(D, P, N, mat, recursion_depth) : Radiance(scene.background);
+            ChargePixel(y*WIDTH + x, counter, since);
+            for(int by = y; by < std::min(y + step, tile.y1); ++by)
+                for(int bx = x; bx < std::min(x + step, tile.x1); ++bx)
+                {
+                    frame[by*WIDTH + bx] = L;
+                    ids[by*WIDTH + bx] = id;
+                }
+        }
+}
 
-            Sphere sphere1(Point(4, 6.8, -2.6), 1.7, window);
+// Adds sample number n (the first one is the pixel center) to every edge pixel of the tile
+// that has n samples so far.
+void RefineTile(std::vector<Radiance> &frame, const std::vector<char> &edges, std::vector<uint16_t> &samples, Camera &camera, const Tile &tile, int n)
+{
+    RayCounter &counter = ray_counter();
+    for(int y = tile.y0; y < tile.y1; ++y)
+        for(int x = tile.x0; x < tile.x1; ++x)
+        {
+            int i = y*WIDTH + x;
+            if(!edges[i] || samples[i] != n)
+                continue;
+            float ox = n * 0.7548776662f, oy = n * 0.5698402910f;
+            ox -= floorf(ox);
+            oy -= floorf(oy);
+            Vector D = camera.point_to_vector(y - HEIGHT/2 + oy - 0.5f, x - WIDTH/2 + ox - 0.5f);
+            uint64_t since = TracedRays(counter);
+            counter.primary++;
+            frame[i] = (frame[i] * n + TraceRay(camera.O, D, 1, INF, recursion_depth)) * (1.f / (n + 1));
+            ChargePixel(i, counter, since);
+            samples[i] = n + 1;
+        }
+}
 
-            objects.push_back(&env);
-            objects.push_back(&sphere1);
+// Renders coarse to fine until time_budget ms have passed: a 1/64 pixel grid that is always
+// completed, finer grids down to every pixel, then extra samples on edge pixels up to
+// aa_samples (PROGRESSIVE_MAX_SAMPLES when anti-aliasing is off). Whatever level the
+// deadline interrupts, frame holds a complete image.
+#define PROGRESSIVE_START_STEP 8
+#define PROGRESSIVE_MAX_SAMPLES 16
 
-            lights.push_back(Light(1, 0.5, Point(10,10,-35)));
-            lights.push_back(Light(1, 0.3, Point(-5,-30,-10)));
-            lights.push_back(Light(1, 0.4, Point(-20,50,-40)));
-            lights.push_back(Light(0, 0.05));
+void RenderProgressive(std::vector<Radiance> &frame, std::vector<uint32_t> &ids, Camera &camera)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point deadline = start + std::chrono::milliseconds(time_budget);
 
-            Camera camera(Point(0,0,-40), Vector(0,0,1), 90);
+    int step = PROGRESSIVE_START_STEP;
+    RenderPass("Progressive 1/8", [&](const Tile &tile) { RenderTileLevel(frame, ids, camera, tile, step, true); });
+    bool complete = true;
+    while(step > 1 && complete)
+    {
+        step /= 2;
+        std::string label = "Progressive 1/" + std::to_string(step);
+        complete = RenderPass(label.c_str(), [&](const Tile &tile) { RenderTileLevel(frame, ids, camera, tile, step, false); }, deadline);
+    }
 
-            render(image, camera);
+    std::string reached = "stopped in the 1/" + std::to_string(step) + " pixel grid";
+    if(complete)
+    {
+        // every round that finishes gives all edge pixels one more sample
+        std::vector<char> edges = FindEdges(frame, ids);
+        std::vector<uint16_t> samples(frame.size(), 1);
+        int max_samples = aa_samples > 1 ? aa_samples : PROGRESSIVE_MAX_SAMPLES;
+        int n = 1;
+        for(; n < max_samples; ++n)
+        {
+            std::string label = "Progressive sample " + std::to_string(n + 1);
+            if(!RenderPass(label.c_str(), [&](const Tile &tile) { RefineTile(frame, edges, samples, camera, tile, n); }, deadline))
+                break;
+        }
+        reached = "full resolution, " + std::to_string(std::count(edges.begin(), edges.end(), 1)) + " edge pixels at " +
+                  std::to_string(n) + (n < max_samples ? "+" : "") + " samples";
+    }
+    std::cout << "Progressive: " << reached << " after "
+              << std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+}
 
-			return true;
-		}
-		default:
-		{
-			std::cout << "Bad scene" << std::endl;
 
-			return false;
-		}
-	}
+// Renders one frame of the scene set up by build_scene, which can be rendered any number of times.
+// cost, when the caller sized it, receives the rays traced for each pixel.
+void render(std::vector<uint32_t> &image, std::vector<Radiance> &hdr, std::vector<uint32_t> &cost, Camera &camera)
+{
+    std::fill(cost.begin(), cost.end(), 0);
+    pixel_rays = cost.empty() ? NULL : cost.data();
+    primitives.reset_counters();
+    meshes.reset_counters();
+    for(RayCounter &c: ray_counters)
+        c = RayCounter();
+
+    // hdr, when the caller asked for it, doubles as the float framebuffer
+    std::vector<Radiance> own_frame;
+    std::vector<Radiance> &frame = hdr.empty() ? own_frame : hdr;
+    frame.resize(WIDTH * HEIGHT);
+    std::vector<uint32_t> ids(WIDTH * HEIGHT);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if(time_budget > 0)
+        RenderProgressive(frame, ids, camera);
+    else
+        RenderPass("Progress", [&](const Tile &tile) { RenderTile(frame, ids, camera, tile); });
+
+    if(aa_samples > 1 && time_budget <= 0)
+    {
+        std::vector<char> edges = FindEdges(frame, ids);
+        size_t count = std::count(edges.begin(), edges.end(), 1);
+        RenderPass("Anti-aliasing", [&](const Tile &tile) { SupersampleTile(frame, edges, camera, tile); });
+        std::cout << "Anti-aliasing: " << count << " pixels (" << 100.f * count / edges.size() << "%) at " << aa_samples
+                  << " samples" << std::endl;
+    }
 
-    return false;
-}
\ No newline at end of file
+    #pragma omp parallel for
+    for(int i = 0; i < WIDTH * HEIGHT; ++i)
+        image[i] = frame[i].hex(); // the one tone map and quantization step
+    std::cout << "Render: " << std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+
+    stats.frames++;
+    stats.render += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    TraceSpan("Render", "render", start, std::chrono::steady_clock::now());
+    for(const RayCounter &c: ray_counters)
+    {
+        stats.primary += c.primary;
+        stats.reflection += c.reflection;
+        stats.refraction += c.refraction;
+        stats.shadow += c.shadow;
+        stats.culled += c.culled;
+        stats.rescued += c.rescued;
+        stats.plane_tests += c.plane_tests;
+    }
+    pixel_rays = NULL;
+    uint64_t rays, nodes, tests;
+    primitives.sphere_bvh.totals(rays, nodes, tests);
+    stats.sphere_tests += tests;
+    primitives.triangle_bvh.totals(rays, nodes, tests);
+    stats.triangle_tests += tests;
+    for(const Model &mesh: meshes.meshes)
+    {
+        mesh.bvh.totals(rays, nodes, tests);
+        stats.mesh_tests += tests;
+    }
+
+    std::cout << "Primitive BVHs: " << primitives.avg_visited() << " nodes visited per ray" << std::endl;
+    if(!meshes.empty())
+    {
+        std::cout << "Instance BVH: " << meshes.bvh.avg_visited() << " nodes visited per ray" << std::endl;
+        for(size_t i = 0; i < meshes.meshes.size(); ++i)
+            std::cout << "Mesh " << meshes.files[i] << ": " << meshes.meshes[i].bvh.avg_visited() << " nodes visited per ray"
+                      << std::endl;
+    }
+
+   return;
+}
+
+
+// Decodes the environment map from TEXTURES_DIR, its colors scaled by scale.
+static bool LoadEnvmap(const std::string &file, float scale)
+{
+    int n = -1;
+    unsigned char *data = stbi_load((TEXTURES_DIR + file).c_str(), &envmap_width, &envmap_height, &n, 0);
+    if (!data || 3!=n)
+    {
+        std::cerr << "Error: can not load the environment map" << std::endl;
+        return false;
+    }
+    envmap = std::vector<Color>(envmap_width*envmap_height);
+    for (int j = 0; j<envmap_height; j++)
+        for (int i = 0; i<envmap_width; i++)
+            envmap[i+j*envmap_width] = Color(data[(i+j*envmap_width)*3+0], data[(i+j*envmap_width)*3+1], data[(i+j*envmap_width)*3+2]) * scale;
+    stbi_image_free(data);
+    return true;
+}
+
+
+// Loads the scene file with its envmap and meshes, builds the acceleration structures and
+// sets camera to the scene's camera. Everything stays loaded for later render() calls.
+bool build_scene(const std::string &path, Camera &camera)
+{
+	omp_set_num_threads(threads);
+    std::cout << "Threads: " << threads << ", tile: " << tile_size << "x" << tile_size << ", packet: " << packet_size << "x" << packet_size
+              << ", SIMD kernels: " << tri_kernel_name << std::endl;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now(), build_start = start;
+    if(!LoadScene(path, scene))
+        return false;
+    std::cout << "Scene: " << path << std::endl;
+    stats.scene = path;
+    stats.width = WIDTH;
+    stats.height = HEIGHT;
+    stats.threads = threads;
+    stats.scene_load = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    TraceSpan("Scene file", "setup", start, std::chrono::steady_clock::now());
+
+    start = std::chrono::steady_clock::now();
+    envmap.clear();
+    if(!scene.envmap.empty() && !LoadEnvmap(scene.envmap, scene.envmap_scale))
+        return false;
+    stats.envmap_load = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    TraceSpan("Envmap decode", "setup", start, std::chrono::steady_clock::now());
+
+    start = std::chrono::steady_clock::now();
+    meshes.build(scene.meshes);
+    // the instance BVH is built last and counts as acceleration, like in stats
+    TraceTime meshes_done = std::chrono::steady_clock::now();
+    TraceTime instances_start = meshes_done - std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                  std::chrono::duration<float, std::milli>(meshes.bvh.build_ms));
+    TraceSpan("Mesh load", "setup", start, instances_start);
+    TraceSpan("Instance BVH build", "setup", instances_start, meshes_done);
+    stats.mesh_load = std::chrono::duration<double>(meshes_done - start).count() - meshes.bvh.build_ms / 1000;
+
+    start = std::chrono::steady_clock::now();
+    BuildAcceleration();
+    TraceSpan("Acceleration build", "setup", start, std::chrono::steady_clock::now());
+    stats.accel_build = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() + meshes.bvh.build_ms / 1000;
+
+    camera = scene.camera;
+    TraceSpan("Scene build", "setup", build_start, std::chrono::steady_clock::now());
+    return true;
+}
@@ -0,0 +1,173 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include "scene.h"
+
+
+Scene::Scene(): background(0, 0, 0), envmap_scale(1), camera(Point(0, 0, 0), Vector(0, 0, 1), 60) {}
+
+void Scene::clear()
+{
+    *this = Scene();
+}
+
+
+static bool ReadPoint(std::istream &in, Point &p)
+{
+    return bool(in >> p.x >> p.y >> p.z);
+}
+
+static bool ReadVector(std::istream &in, Vector &v)
+{
+    return bool(in >> v.x >> v.y >> v.z);
+}
+
+static bool ReadColor(std::istream &in, Color &c)
+{
+    return bool(in >> c.R >> c.G >> c.B);
+}
+
+
+bool LoadScene(const std::string &path, Scene &scene)
+{
+    std::ifstream file(path);
+    if(!file)
+    {
+        std::cerr << "Error: can not open the scene file " << path << std::endl;
+        return false;
+    }
+
+    scene.clear();
+    std::map<std::string, Material> materials;
+    std::string line, error;
+    int number = 0;
+    while(error.empty() && std::getline(file, line))
+    {
+        ++number;
+        std::istringstream in(line.substr(0, line.find('#')));
+        std::string key;
+        if(!(in >> key))
+            continue;
+
+        std::string name;
+        Material mat, mat_2;
+        // Reads a material name and looks it up, error is set for unknown ones.
+        auto material = [&](Material &m) -> bool {
+            if(!(in >> name))
+                return false;
+            std::map<std::string, Material>::const_iterator it = materials.find(name);
+            if(it == materials.end())
+            {
+                error = "unknown material " + name;
+                return false;
+            }
+            m = it->second;
+            return true;
+        };
+
+        bool ok = false;
+        if(key == "material")
+        {
+            Color c;
+            int specular;
+            float specular_index, reflective, refractive_index, refractive;
+            ok = in >> name && ReadColor(in, c) && in >> specular >> specular_index >> reflective >> refractive_index >> refractive;
+            if(ok)
+                materials[name] = Material(c, specular, specular_index, reflective, refractive_index, refractive);
+        }
+        else if(key == "sphere")
+        {
+            Point c;
+            float radius;
+            ok = ReadPoint(in, c) && in >> radius && material(mat);
+            if(ok)
+                scene.objects.emplace_back(new Sphere(c, radius, mat));
+        }
+        else if(key == "plane")
+        {
+            Vector n;
+            Point p;
+            ok = ReadVector(in, n) && ReadPoint(in, p) && material(mat);
+            if(ok && !(in >> std::ws).eof())
+                ok = material(mat_2);
+            else
+                mat_2 = mat;
+            if(ok)
+                scene.objects.emplace_back(new Plane(n, p, mat, mat_2));
+        }
+        else if(key == "triangle")
+        {
+            Point v0, v1, v2;
+            ok = ReadPoint(in, v0) && ReadPoint(in, v1) && ReadPoint(in, v2) && material(mat);
+            if(ok)
+                scene.objects.emplace_back(new Triangle(v0, v1, v2, mat));
+        }
+        else if(key == "mesh")
+        {
+            MeshDesc mesh;
+            ok = in >> mesh.file && material(mesh.material);
+            std::string op;
+            while(ok && in >> op)
+            {
+                float x, y, z;
+                char axis;
+                if(op == "translate" && (ok = bool(in >> x >> y >> z)))
+                    mesh.transform = Transform::translate(x, y, z) * mesh.transform;
+                else if(op == "rotate" && (ok = in >> axis >> x && (axis == 'x' || axis == 'y' || axis == 'z')))
+                    mesh.transform = Transform::rotate(axis, x) * mesh.transform;
+                else if(op == "scale" && (ok = in >> x && x != 0))
+                    mesh.transform = Transform::scale(x) * mesh.transform;
+                else
+                    ok = false;
+            }
+            if(ok)
+                scene.meshes.push_back(mesh);
+        }
+        else if(key == "light")
+        {
+            std::string type;
+            float intensity;
+            Point p;
+            Vector d;
+            ok = bool(in >> type >> intensity);
+            if(ok && type == "ambient")
+                scene.lights.push_back(Light(0, intensity));
+            else if(ok && type == "point" && (ok = ReadPoint(in, p)))
+                scene.lights.push_back(Light(1, intensity, p));
+            else if(ok && type == "directional" && (ok = ReadVector(in, d)))
+                scene.lights.push_back(Light(2, intensity, d));
+            else if(ok)
+                error = "unknown light type " + type;
+        }
+        else if(key == "camera")
+        {
+            Point o;
+            Vector d;
+            float fov;
+            ok = ReadPoint(in, o) && ReadVector(in, d) && in >> fov;
+            if(ok)
+                scene.camera = Camera(o, d, fov);
+        }
+        else if(key == "envmap")
+        {
+            ok = bool(in >> scene.envmap >> scene.envmap_scale);
+            if(ok)
+                scene.objects.emplace_back(new Sphere(Point(0, 0, 0), 100, Material()));
+        }
+        else if(key == "background")
+            ok = ReadColor(in, scene.background);
+        else
+            error = "unknown statement " + key;
+
+        if(error.empty() && (!ok || !(in >> std::ws).eof()))
+            error = "bad " + key + " statement";
+    }
+
+    if(!error.empty())
+    {
+        std::cerr << "Error: " << path << ":" << number << ": " << error << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include "geometry.h"
+
+extern std::string SCENES_DIR;
+
+
+// One instance of a triangle mesh, an OBJ file in MODELS_DIR. Instances of the same
+// file share its geometry.
+struct MeshDesc
+{
+    std::string file;
+    Material material;
+    Transform transform; // object to world
+};
+
+
+// Everything a scene file describes. The scene owns its objects; meshes and the envmap are
+// only named here and get loaded by build_scene, which also builds the acceleration structures.
+struct Scene
+{
+    std::vector<std::unique_ptr<Object>> objects;
+    std::vector<Light> lights;
+    Color background;
+    std::string envmap; // image in TEXTURES_DIR, empty for none
+    float envmap_scale;
+    std::vector<MeshDesc> meshes;
+    Camera camera;
+
+    Scene();
+    void clear();
+};
+
+
+// Parses a scene file into scene, reporting the first bad line on std::cerr.
+//
+// One statement per line, # starts a comment. Materials are named and must be defined
+// before they are used:
+//   material <name> <r> <g> <b> <specular> <specular_index> <reflective> <refractive_index> <refractive>
+//   sphere <cx> <cy> <cz> <radius> <material>
+//   plane <nx> <ny> <nz> <px> <py> <pz> <material> [<checker material>]
+//   triangle <x0> <y0> <z0> <x1> <y1> <z1> <x2> <y2> <z2> <material>
+//   mesh <obj file> <material> [translate <x> <y> <z>] [rotate <x|y|z> <degrees>] [scale <s>] ...
+//        (transforms apply in the order given)
+//   light ambient <intensity>
+//   light point <intensity> <x> <y> <z>
+//   light directional <intensity> <dx> <dy> <dz>
+//   camera <ox> <oy> <oz> <dx> <dy> <dz> <fov>
+//   envmap <image file> <scale>  (also adds the sky sphere of radius 100 around the origin)
+//   background <r> <g> <b>
+bool LoadScene(const std::string &path, Scene &scene);
+
+
+#endif
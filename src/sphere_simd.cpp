@@ -0,0 +1,199 @@
+#include <cstring>
+#include "sphere_simd.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SPHERE_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(SPHERE_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define SPHERE_SIMD_AVX2 1
+#endif
+
+
+// Smallest t among the lanes in mask, t_max is only an upper bound the mask already respects.
+static int nearest_lane(int mask, const float *ts, float &t_max)
+{
+    int best = -1;
+    for (int i = 0; mask; ++i, mask >>= 1)
+        if ((mask & 1) && (best < 0 || ts[i] < t_max)) {
+            t_max = ts[i];
+            best = i;
+        }
+    return best;
+}
+
+
+int sphere_packet_scalar(const SpherePacket &p, const Point &O, const Vector &D, int begin, int end, float t_min, float &t_max)
+{
+    float k1 = D.x*D.x + D.y*D.y + D.z*D.z;
+    float inv_2k1 = 0.5f / k1;
+    int best = -1;
+    for (int i = begin; i < end; ++i) {
+        float ocx = O.x - p.cx[i], ocy = O.y - p.cy[i], ocz = O.z - p.cz[i];
+        float k2 = 2.f * (ocx*D.x + ocy*D.y + ocz*D.z);
+        float k3 = (ocx*ocx + ocy*ocy + ocz*ocz) - p.r2[i];
+        float discriminant = k2*k2 - 4.f*k1*k3;
+        if (discriminant < 0.f) continue;
+
+        float root = sqrtf(discriminant);
+        float t = (-k2 - root) * inv_2k1;
+        if (t < t_min)
+            t = (-k2 + root) * inv_2k1;
+        if (t >= t_min && t <= t_max && (best < 0 || t < t_max)) {
+            t_max = t;
+            best = i;
+        }
+    }
+    return best;
+}
+
+
+#ifdef SPHERE_SIMD_X86
+
+// Four lanes starting at `at`, returns the hit mask and per-lane t.
+static inline int sphere_sse4(const SpherePacket &p, int at, __m128 ox, __m128 oy, __m128 oz, __m128 dx, __m128 dy, __m128 dz,
+                              __m128 k1x4, __m128 inv_2k1, __m128 t_min, __m128 t_max, __m128 &t)
+{
+    __m128 ocx = _mm_sub_ps(ox, _mm_loadu_ps(p.cx + at));
+    __m128 ocy = _mm_sub_ps(oy, _mm_loadu_ps(p.cy + at));
+    __m128 ocz = _mm_sub_ps(oz, _mm_loadu_ps(p.cz + at));
+    __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+    __m128 k2 = _mm_add_ps(b, b);
+    __m128 k3 = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz)), _mm_loadu_ps(p.r2 + at));
+    __m128 disc = _mm_sub_ps(_mm_mul_ps(k2, k2), _mm_mul_ps(k1x4, k3));
+    __m128 valid = _mm_cmpge_ps(disc, _mm_setzero_ps());
+
+    __m128 root = _mm_sqrt_ps(_mm_max_ps(disc, _mm_setzero_ps()));
+    __m128 neg_k2 = _mm_sub_ps(_mm_setzero_ps(), k2);
+    __m128 near = _mm_mul_ps(_mm_sub_ps(neg_k2, root), inv_2k1);
+    __m128 far = _mm_mul_ps(_mm_add_ps(neg_k2, root), inv_2k1);
+    __m128 use_far = _mm_cmplt_ps(near, t_min);
+    t = _mm_or_ps(_mm_and_ps(use_far, far), _mm_andnot_ps(use_far, near));
+
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(t, t_min), _mm_cmple_ps(t, t_max)));
+    return _mm_movemask_ps(valid);
+}
+
+int sphere_packet_sse(const SpherePacket &p, const Point &O, const Vector &D, int begin, int end, float t_min, float &t_max)
+{
+    __m128 ox = _mm_set1_ps(O.x), oy = _mm_set1_ps(O.y), oz = _mm_set1_ps(O.z);
+    __m128 dx = _mm_set1_ps(D.x), dy = _mm_set1_ps(D.y), dz = _mm_set1_ps(D.z);
+    float k1 = D.x*D.x + D.y*D.y + D.z*D.z;
+    __m128 k1x4 = _mm_set1_ps(4.f * k1), inv_2k1 = _mm_set1_ps(0.5f / k1);
+    __m128 lo = _mm_set1_ps(t_min), hi = _mm_set1_ps(t_max);
+    int range = ((1 << end) - 1) & ~((1 << begin) - 1);
+
+    float ts[SPHERE_PACKET_WIDTH];
+    __m128 t;
+    int mask = 0;
+    if (range & 0x0F) {
+        mask |= sphere_sse4(p, 0, ox, oy, oz, dx, dy, dz, k1x4, inv_2k1, lo, hi, t);
+        _mm_storeu_ps(ts, t);
+    }
+    if (range & 0xF0) {
+        mask |= sphere_sse4(p, 4, ox, oy, oz, dx, dy, dz, k1x4, inv_2k1, lo, hi, t) << 4;
+        _mm_storeu_ps(ts + 4, t);
+    }
+    return nearest_lane(mask & range, ts, t_max);
+}
+
+#else
+
+int sphere_packet_sse(const SpherePacket &p, const Point &O, const Vector &D, int begin, int end, float t_min, float &t_max)
+{
+    return sphere_packet_scalar(p, O, D, begin, end, t_min, t_max);
+}
+
+#endif
+
+
+#ifdef SPHERE_SIMD_AVX2
+
+__attribute__((target("avx2")))
+int sphere_packet_avx2(const SpherePacket &p, const Point &O, const Vector &D, int begin, int end, float t_min, float &t_max)
+{
+    __m256 ocx = _mm256_sub_ps(_mm256_set1_ps(O.x), _mm256_loadu_ps(p.cx));
+    __m256 ocy = _mm256_sub_ps(_mm256_set1_ps(O.y), _mm256_loadu_ps(p.cy));
+    __m256 ocz = _mm256_sub_ps(_mm256_set1_ps(O.z), _mm256_loadu_ps(p.cz));
+    __m256 dx = _mm256_set1_ps(D.x), dy = _mm256_set1_ps(D.y), dz = _mm256_set1_ps(D.z);
+    float k1 = D.x*D.x + D.y*D.y + D.z*D.z;
+
+    __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)), _mm256_mul_ps(ocz, dz));
+    __m256 k2 = _mm256_add_ps(b, b);
+    __m256 k3 = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz)),
+                              _mm256_loadu_ps(p.r2));
+    __m256 zero = _mm256_setzero_ps();
+    __m256 disc = _mm256_sub_ps(_mm256_mul_ps(k2, k2), _mm256_mul_ps(_mm256_set1_ps(4.f * k1), k3));
+    __m256 valid = _mm256_cmp_ps(disc, zero, _CMP_GE_OQ);
+
+    __m256 inv_2k1 = _mm256_set1_ps(0.5f / k1);
+    __m256 root = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+    __m256 neg_k2 = _mm256_sub_ps(zero, k2);
+    __m256 near = _mm256_mul_ps(_mm256_sub_ps(neg_k2, root), inv_2k1);
+    __m256 far = _mm256_mul_ps(_mm256_add_ps(neg_k2, root), inv_2k1);
+    __m256 lo = _mm256_set1_ps(t_min);
+    __m256 t = _mm256_blendv_ps(near, far, _mm256_cmp_ps(near, lo, _CMP_LT_OQ));
+
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, lo, _CMP_GE_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(t_max), _CMP_LE_OQ)));
+    int range = ((1 << end) - 1) & ~((1 << begin) - 1);
+    int mask = _mm256_movemask_ps(valid) & range;
+    if (!mask)
+        return -1;
+    float ts[SPHERE_PACKET_WIDTH];
+    _mm256_storeu_ps(ts, t);
+    return nearest_lane(mask, ts, t_max);
+}
+
+static bool has_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+int sphere_packet_avx2(const SpherePacket &p, const Point &O, const Vector &D, int begin, int end, float t_min, float &t_max)
+{
+    return sphere_packet_sse(p, O, D, begin, end, t_min, t_max);
+}
+
+static bool has_avx2()
+{
+    return false;
+}
+
+#endif
+
+
+SpherePacketKernel find_sphere_kernel(const char *name)
+{
+    if (!strcmp(name, "scalar"))
+        return sphere_packet_scalar;
+#ifdef SPHERE_SIMD_X86
+    if (!strcmp(name, "sse"))
+        return sphere_packet_sse;
+#endif
+    if (!strcmp(name, "avx2") && has_avx2())
+        return sphere_packet_avx2;
+    return NULL;
+}
+
+bool use_sphere_kernel(const char *name)
+{
+    SpherePacketKernel kernel = find_sphere_kernel(name);
+    if (kernel)
+        sphere_packet_intersect = kernel;
+    return kernel != NULL;
+}
+
+static SpherePacketKernel best_sphere_kernel()
+{
+    const char *names[] = {"avx2", "sse"};
+    for (const char *name : names)
+        if (find_sphere_kernel(name))
+            return find_sphere_kernel(name);
+    return sphere_packet_scalar;
+}
+
+SpherePacketKernel sphere_packet_intersect = best_sphere_kernel();
@@ -0,0 +1,33 @@
+#ifndef SPHERE_SIMD_H
+#define SPHERE_SIMD_H
+
+#include "geometry.h"
+
+#define SPHERE_PACKET_WIDTH 8
+
+
+// Eight spheres in structure-of-arrays layout: center and squared radius per lane.
+struct SpherePacket
+{
+    float cx[SPHERE_PACKET_WIDTH], cy[SPHERE_PACKET_WIDTH], cz[SPHERE_PACKET_WIDTH];
+    float r2[SPHERE_PACKET_WIDTH];
+};
+
+
+// Tests one ray against lanes [begin, end) of a packet. Every lane yields its nearest root
+// that is not below t_min, the kernel returns the lane with the smallest such t <= t_max
+// and stores that t in t_max, or returns -1.
+typedef int (*SpherePacketKernel)(const SpherePacket &p, const Point &O, const Vector &D, int begin, int end, float t_min, float &t_max);
+
+int sphere_packet_scalar(const SpherePacket &p, const Point &O, const Vector &D, int begin, int end, float t_min, float &t_max);
+int sphere_packet_sse(const SpherePacket &p, const Point &O, const Vector &D, int begin, int end, float t_min, float &t_max);
+int sphere_packet_avx2(const SpherePacket &p, const Point &O, const Vector &D, int begin, int end, float t_min, float &t_max);
+
+// Kernel in use, chosen together with the triangle kernel.
+extern SpherePacketKernel sphere_packet_intersect;
+
+// Kernel by name ("scalar", "sse", "avx2"), NULL if unknown or unsupported here.
+SpherePacketKernel find_sphere_kernel(const char *name);
+bool use_sphere_kernel(const char *name);
+
+#endif
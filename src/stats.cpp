@@ -0,0 +1,67 @@
+#include <iostream>
+#include <fstream>
+#include "stats.h"
+
+
+RenderStats stats;
+
+
+RenderStats::RenderStats():
+    width(0), height(0), threads(0), frames(0),
+    scene_load(0), envmap_load(0), mesh_load(0), accel_build(0), render(0), image_write(0),
+    primary(0), reflection(0), refraction(0), shadow(0), culled(0), rescued(0),
+    sphere_tests(0), plane_tests(0), triangle_tests(0), mesh_tests(0) {}
+
+uint64_t RenderStats::rays() const
+{
+    return primary + reflection + refraction + shadow;
+}
+
+float RenderStats::mrays_per_s() const
+{
+    return render > 0 ? rays() / render * 1e-6 : 0.f;
+}
+
+
+void RenderStats::print() const
+{
+    std::cout << "Stats: " << scene << ", " << frames << (frames == 1 ? " frame" : " frames") << " at " << width << "x" << height
+              << ", " << threads << " threads" << std::endl;
+    std::cout << "  Time (ms): scene " << scene_load * 1000 << ", envmap " << envmap_load * 1000 << ", meshes " << mesh_load * 1000
+              << ", acceleration " << accel_build * 1000 << ", render " << render * 1000 << ", image write " << image_write * 1000
+              << std::endl;
+    std::cout << "  Rays: " << primary << " primary, " << reflection << " reflection, " << refraction << " refraction, " << shadow
+              << " shadow, " << mrays_per_s() << " Mrays/s" << std::endl;
+    std::cout << "  Secondary rays: " << culled << " culled, " << rescued << " kept by roulette" << std::endl;
+    std::cout << "  Intersection tests: " << sphere_tests << " sphere, " << plane_tests << " plane, " << triangle_tests
+              << " triangle, " << mesh_tests << " mesh triangle" << std::endl;
+}
+
+
+bool RenderStats::write_json(const std::string &path) const
+{
+    std::ofstream out(path.c_str());
+    std::string name;
+    for(char c: scene) // the path is the only string, escape what a path can hold
+    {
+        if(c == '"' || c == '\\')
+            name += '\\';
+        name += c;
+    }
+    out << "{\n"
+        << "  \"scene\": \"" << name << "\",\n"
+        << "  \"width\": " << width << ",\n"
+        << "  \"height\": " << height << ",\n"
+        << "  \"threads\": " << threads << ",\n"
+        << "  \"frames\": " << frames << ",\n"
+        << "  \"time_s\": {\"scene_load\": " << scene_load << ", \"envmap_load\": " << envmap_load << ", \"mesh_load\": " << mesh_load
+        << ", \"accel_build\": " << accel_build << ", \"render\": " << render << ", \"image_write\": " << image_write << "},\n"
+        << "  \"rays\": {\"primary\": " << primary << ", \"reflection\": " << reflection << ", \"refraction\": " << refraction
+        << ", \"shadow\": " << shadow << ", \"culled\": " << culled << ", \"rescued\": " << rescued << "},\n"
+        << "  \"tests\": {\"sphere\": " << sphere_tests << ", \"plane\": " << plane_tests << ", \"triangle\": " << triangle_tests
+        << ", \"mesh_triangle\": " << mesh_tests << "},\n"
+        << "  \"mrays_per_s\": " << mrays_per_s() << "\n"
+        << "}\n";
+    out.close();
+    return !out.fail();
+}
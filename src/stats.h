@@ -0,0 +1,37 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <string>
+
+
+// What a run spent its time on: wall time per phase in seconds, and the rays and intersection
+// tests of all the frames it rendered. Filled in as the phases run and reported once at the end.
+struct RenderStats
+{
+    std::string scene;
+    int width, height, threads, frames;
+
+    double scene_load; // parsing the scene file
+    double envmap_load;
+    double mesh_load; // OBJ files or their caches, with their BVHs
+    double accel_build; // primitive and instance BVHs
+    double render;
+    double image_write;
+
+    uint64_t primary, reflection, refraction, shadow;
+    uint64_t culled; // secondary rays dropped below min_ray_weight
+    uint64_t rescued; // secondary rays kept by Russian roulette
+    uint64_t sphere_tests, plane_tests, triangle_tests, mesh_tests;
+
+    RenderStats();
+    uint64_t rays() const;
+    float mrays_per_s() const; // all rays over the render time
+    void print() const;
+    bool write_json(const std::string &path) const;
+};
+
+extern RenderStats stats;
+
+
+#endif
@@ -0,0 +1,74 @@
+#include <algorithm>
+#include "tiles.h"
+
+
+static uint64_t pack(uint32_t begin, uint32_t end)
+{
+    return ((uint64_t)begin << 32) | end;
+}
+
+
+TileScheduler::TileScheduler(int w, int h, int tile_size, int workers) : width(w), height(h), size(tile_size), ranges(std::max(1, workers))
+{
+    tiles_x = (width + size - 1) / size;
+    tiles_y = (height + size - 1) / size;
+    int n = ntiles(), k = (int)ranges.size();
+    for (int i = 0; i < k; ++i)
+        ranges[i].span.store(pack((uint32_t)((int64_t)n * i / k), (uint32_t)((int64_t)n * (i + 1) / k)));
+}
+
+int TileScheduler::ntiles() const {
+    return tiles_x * tiles_y;
+}
+
+Tile TileScheduler::tile(int index) const
+{
+    Tile t;
+    t.x0 = (index % tiles_x) * size;
+    t.y0 = (index / tiles_x) * size;
+    t.x1 = std::min(t.x0 + size, width);
+    t.y1 = std::min(t.y0 + size, height);
+    return t;
+}
+
+bool TileScheduler::pop_front(int worker, int &index)
+{
+    std::atomic<uint64_t> &span = ranges[worker].span;
+    uint64_t cur = span.load();
+    for (;;) {
+        uint32_t begin = (uint32_t)(cur >> 32), end = (uint32_t)cur;
+        if (begin >= end)
+            return false;
+        if (span.compare_exchange_weak(cur, pack(begin + 1, end))) {
+            index = (int)begin;
+            return true;
+        }
+    }
+}
+
+bool TileScheduler::pop_back(int worker, int &index)
+{
+    std::atomic<uint64_t> &span = ranges[worker].span;
+    uint64_t cur = span.load();
+    for (;;) {
+        uint32_t begin = (uint32_t)(cur >> 32), end = (uint32_t)cur;
+        if (begin >= end)
+            return false;
+        if (span.compare_exchange_weak(cur, pack(begin, end - 1))) {
+            index = (int)end - 1;
+            return true;
+        }
+    }
+}
+
+bool TileScheduler::next(int worker, int &index)
+{
+    int k = (int)ranges.size();
+    worker %= k;
+    if (pop_front(worker, index))
+        return true;
+    for (int i = 1; i < k; ++i)
+        if (pop_back((worker + i) % k, index))
+            return true;
+    return false;
+}
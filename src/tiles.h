@@ -0,0 +1,41 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+
+struct Tile
+{
+    int x0, y0; // inclusive
+    int x1, y1; // exclusive
+};
+
+
+// Splits the frame into square tiles and hands them out to worker threads.
+// Every worker owns a contiguous run of tiles and takes from its front;
+// a worker that runs dry steals single tiles from the back of the others.
+class TileScheduler {
+private:
+    struct Range
+    {
+        std::atomic<uint64_t> span; // begin in the high half, end in the low half
+        char pad[56];
+    };
+
+    int width, height, size;
+    int tiles_x, tiles_y;
+    std::vector<Range> ranges;
+
+    bool pop_front(int worker, int &index);
+    bool pop_back(int worker, int &index);
+public:
+    TileScheduler(int w, int h, int tile_size, int workers);
+
+    int ntiles() const;
+    Tile tile(int index) const;
+    bool next(int worker, int &index);
+};
+
+#endif
@@ -0,0 +1,78 @@
+#include <fstream>
+#include <algorithm>
+#include <vector>
+#include <omp.h>
+#include "trace.h"
+
+
+namespace {
+struct TraceEvent
+{
+    std::string name;
+    const char *category;
+    int thread;
+    double ts, dur; // microseconds since StartTrace
+    std::string args;
+};
+
+bool enabled = false;
+TraceTime origin;
+std::vector<TraceEvent> events;
+int max_thread = 0;
+}
+
+
+void StartTrace()
+{
+    enabled = true;
+    origin = std::chrono::steady_clock::now();
+    events.clear();
+    max_thread = 0;
+}
+
+bool TraceEnabled()
+{
+    return enabled;
+}
+
+void TraceSpan(const char *name, const char *category, TraceTime start, TraceTime end, const std::string &args)
+{
+    if(!enabled)
+        return;
+    TraceEvent e;
+    e.name = name;
+    e.category = category;
+    e.thread = omp_get_thread_num();
+    e.ts = std::chrono::duration<double, std::micro>(start - origin).count();
+    e.dur = std::chrono::duration<double, std::micro>(end - start).count();
+    e.args = args;
+    #pragma omp critical(trace)
+    {
+        events.push_back(e);
+        max_thread = std::max(max_thread, e.thread);
+    }
+}
+
+
+bool WriteTrace(const std::string &path)
+{
+    std::ofstream out(path.c_str());
+    out.setf(std::ios::fixed);
+    out.precision(3);
+    out << "{\"traceEvents\": [";
+    const char *sep = "\n  ";
+    for(int t = 0; t <= max_thread; ++t, sep = ",\n  ") // names for the thread rows, 0 doubles as the main thread
+        out << sep << "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": " << t << ", \"args\": {\"name\": \""
+            << (t == 0 ? "Main / thread 0" : "Thread " + std::to_string(t)) << "\"}}";
+    for(const TraceEvent &e: events)
+    {
+        out << sep << "{\"ph\": \"X\", \"name\": \"" << e.name << "\", \"cat\": \"" << e.category << "\", \"pid\": 1, \"tid\": "
+            << e.thread << ", \"ts\": " << e.ts << ", \"dur\": " << e.dur;
+        if(!e.args.empty())
+            out << ", \"args\": {" << e.args << "}";
+        out << "}";
+    }
+    out << "\n], \"displayTimeUnit\": \"ms\"}\n";
+    out.close();
+    return !out.fail();
+}
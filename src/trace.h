@@ -0,0 +1,20 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <string>
+
+typedef std::chrono::steady_clock::time_point TraceTime;
+
+
+// Timeline of a run in the Chrome trace event format, for about:tracing or Perfetto. Nothing
+// is recorded until StartTrace; spans land on the OpenMP thread that records them, so the
+// tiles of a pass show how the work was spread over the threads.
+void StartTrace();
+bool TraceEnabled();
+// args, when given, is the inside of a JSON object, e.g. "\"x\": 0, \"y\": 16".
+void TraceSpan(const char *name, const char *category, TraceTime start, TraceTime end, const std::string &args = "");
+bool WriteTrace(const std::string &path);
+
+
+#endif
@@ -0,0 +1,215 @@
+#include <cstring>
+#include "tri_simd.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define TRI_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(TRI_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TRI_SIMD_AVX2 1
+#endif
+
+
+// Picks the closest lane among the hits in mask, ts holds per-lane distances.
+static int closest_lane(int mask, const float *ts, float &t_max)
+{
+    int best = -1;
+    for (int i = 0; mask; ++i, mask >>= 1)
+        if ((mask & 1) && ts[i] < t_max) {
+            t_max = ts[i];
+            best = i;
+        }
+    return best;
+}
+
+
+int tri_packet_scalar(const TriPacket &p, const Point &O, const Vector &D, int begin, int end, float &t_max)
+{
+    int best = -1;
+    for (int i = begin; i < end; ++i) {
+        float px = D.y*p.e2z[i] - D.z*p.e2y[i], py = D.z*p.e2x[i] - D.x*p.e2z[i], pz = D.x*p.e2y[i] - D.y*p.e2x[i];
+        float det = p.e1x[i]*px + p.e1y[i]*py + p.e1z[i]*pz;
+        if (det < 1e-5f && det > -1e-5f) continue;
+
+        float tx = O.x - p.v0x[i], ty = O.y - p.v0y[i], tz = O.z - p.v0z[i];
+        float u = tx*px + ty*py + tz*pz;
+        if (u < 0 || u > det) continue;
+
+        float qx = ty*p.e1z[i] - tz*p.e1y[i], qy = tz*p.e1x[i] - tx*p.e1z[i], qz = tx*p.e1y[i] - ty*p.e1x[i];
+        float v = D.x*qx + D.y*qy + D.z*qz;
+        if (v < 0 || u + v > det) continue;
+
+        float t = (p.e2x[i]*qx + p.e2y[i]*qy + p.e2z[i]*qz) / det;
+        if (t > 1e-5f && t < t_max) {
+            t_max = t;
+            best = i;
+        }
+    }
+    return best;
+}
+
+
+#ifdef TRI_SIMD_X86
+
+// Four lanes starting at `at`, returns the hit mask and per-lane t.
+static inline int tri_sse4(const TriPacket &p, int at, __m128 ox, __m128 oy, __m128 oz, __m128 dx, __m128 dy, __m128 dz, __m128 t_max, __m128 &t)
+{
+    __m128 e1x = _mm_loadu_ps(p.e1x + at), e1y = _mm_loadu_ps(p.e1y + at), e1z = _mm_loadu_ps(p.e1z + at);
+    __m128 e2x = _mm_loadu_ps(p.e2x + at), e2y = _mm_loadu_ps(p.e2y + at), e2z = _mm_loadu_ps(p.e2z + at);
+
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+
+    __m128 tx = _mm_sub_ps(ox, _mm_loadu_ps(p.v0x + at));
+    __m128 ty = _mm_sub_ps(oy, _mm_loadu_ps(p.v0y + at));
+    __m128 tz = _mm_sub_ps(oz, _mm_loadu_ps(p.v0z + at));
+    __m128 u = _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz));
+
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+    __m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz));
+
+    t = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), det);
+
+    __m128 zero = _mm_setzero_ps();
+    __m128 ok = _mm_cmpge_ps(det, _mm_set1_ps(1e-5f)); // u in [0, det] already rules out det <= -1e-5
+    ok = _mm_and_ps(ok, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, det)));
+    ok = _mm_and_ps(ok, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), det)));
+    ok = _mm_and_ps(ok, _mm_and_ps(_mm_cmpgt_ps(t, _mm_set1_ps(1e-5f)), _mm_cmplt_ps(t, t_max)));
+    return _mm_movemask_ps(ok);
+}
+
+int tri_packet_sse(const TriPacket &p, const Point &O, const Vector &D, int begin, int end, float &t_max)
+{
+    __m128 ox = _mm_set1_ps(O.x), oy = _mm_set1_ps(O.y), oz = _mm_set1_ps(O.z);
+    __m128 dx = _mm_set1_ps(D.x), dy = _mm_set1_ps(D.y), dz = _mm_set1_ps(D.z);
+    int range = ((1 << end) - 1) & ~((1 << begin) - 1);
+
+    float ts[TRI_PACKET_WIDTH];
+    __m128 t;
+    int mask = 0;
+    if (range & 0x0F) {
+        mask |= tri_sse4(p, 0, ox, oy, oz, dx, dy, dz, _mm_set1_ps(t_max), t);
+        _mm_storeu_ps(ts, t);
+    }
+    if (range & 0xF0) {
+        mask |= tri_sse4(p, 4, ox, oy, oz, dx, dy, dz, _mm_set1_ps(t_max), t) << 4;
+        _mm_storeu_ps(ts + 4, t);
+    }
+    return closest_lane(mask & range, ts, t_max);
+}
+
+#else
+
+int tri_packet_sse(const TriPacket &p, const Point &O, const Vector &D, int begin, int end, float &t_max)
+{
+    return tri_packet_scalar(p, O, D, begin, end, t_max);
+}
+
+#endif
+
+
+#ifdef TRI_SIMD_AVX2
+
+__attribute__((target("avx2")))
+int tri_packet_avx2(const TriPacket &p, const Point &O, const Vector &D, int begin, int end, float &t_max)
+{
+    __m256 ox = _mm256_set1_ps(O.x), oy = _mm256_set1_ps(O.y), oz = _mm256_set1_ps(O.z);
+    __m256 dx = _mm256_set1_ps(D.x), dy = _mm256_set1_ps(D.y), dz = _mm256_set1_ps(D.z);
+
+    __m256 e1x = _mm256_loadu_ps(p.e1x), e1y = _mm256_loadu_ps(p.e1y), e1z = _mm256_loadu_ps(p.e1z);
+    __m256 e2x = _mm256_loadu_ps(p.e2x), e2y = _mm256_loadu_ps(p.e2y), e2z = _mm256_loadu_ps(p.e2z);
+
+    __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+    __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+
+    __m256 tx = _mm256_sub_ps(ox, _mm256_loadu_ps(p.v0x));
+    __m256 ty = _mm256_sub_ps(oy, _mm256_loadu_ps(p.v0y));
+    __m256 tz = _mm256_sub_ps(oz, _mm256_loadu_ps(p.v0z));
+    __m256 u = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz));
+
+    __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+    __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+    __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+    __m256 v = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz));
+
+    __m256 t = _mm256_div_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), det);
+
+    __m256 zero = _mm256_setzero_ps();
+    __m256 ok = _mm256_cmp_ps(det, _mm256_set1_ps(1e-5f), _CMP_GE_OQ);
+    ok = _mm256_and_ps(ok, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, det, _CMP_LE_OQ)));
+    ok = _mm256_and_ps(ok, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), det, _CMP_LE_OQ)));
+    ok = _mm256_and_ps(ok, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(1e-5f), _CMP_GT_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(t_max), _CMP_LT_OQ)));
+
+    int range = ((1 << end) - 1) & ~((1 << begin) - 1);
+    int mask = _mm256_movemask_ps(ok) & range;
+    if (!mask)
+        return -1;
+    float ts[TRI_PACKET_WIDTH];
+    _mm256_storeu_ps(ts, t);
+    return closest_lane(mask, ts, t_max);
+}
+
+static bool has_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+int tri_packet_avx2(const TriPacket &p, const Point &O, const Vector &D, int begin, int end, float &t_max)
+{
+    return tri_packet_sse(p, O, D, begin, end, t_max);
+}
+
+static bool has_avx2()
+{
+    return false;
+}
+
+#endif
+
+
+static const char *const TRI_KERNEL_NAMES[] = {"scalar", "sse", "avx2"};
+
+TriPacketKernel find_tri_kernel(const char *name)
+{
+    if (!strcmp(name, "scalar"))
+        return tri_packet_scalar;
+#ifdef TRI_SIMD_X86
+    if (!strcmp(name, "sse"))
+        return tri_packet_sse;
+#endif
+    if (!strcmp(name, "avx2") && has_avx2())
+        return tri_packet_avx2;
+    return NULL;
+}
+
+bool use_tri_kernel(const char *name)
+{
+    for (const char *known : TRI_KERNEL_NAMES)
+        if (!strcmp(name, known) && find_tri_kernel(known)) {
+            tri_kernel_name = known;
+            tri_packet_intersect = find_tri_kernel(known);
+            return true;
+        }
+    return false;
+}
+
+static const char *best_tri_kernel()
+{
+    for (int i = 2; i > 0; --i)
+        if (find_tri_kernel(TRI_KERNEL_NAMES[i]))
+            return TRI_KERNEL_NAMES[i];
+    return TRI_KERNEL_NAMES[0];
+}
+
+const char *tri_kernel_name = best_tri_kernel();
+TriPacketKernel tri_packet_intersect = find_tri_kernel(tri_kernel_name);
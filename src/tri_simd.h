@@ -0,0 +1,35 @@
+#ifndef TRI_SIMD_H
+#define TRI_SIMD_H
+
+#include "geometry.h"
+
+#define TRI_PACKET_WIDTH 8
+
+
+// Eight triangles in structure-of-arrays layout: first vertex and both edges
+// from it per lane. Unused lanes hold degenerate (all zero) triangles.
+struct TriPacket
+{
+    float v0x[TRI_PACKET_WIDTH], v0y[TRI_PACKET_WIDTH], v0z[TRI_PACKET_WIDTH];
+    float e1x[TRI_PACKET_WIDTH], e1y[TRI_PACKET_WIDTH], e1z[TRI_PACKET_WIDTH];
+    float e2x[TRI_PACKET_WIDTH], e2y[TRI_PACKET_WIDTH], e2z[TRI_PACKET_WIDTH];
+};
+
+
+// Tests one ray against lanes [begin, end) of a packet. Returns the lane of the
+// closest front-facing hit with 1e-5 < t < t_max and stores its t in t_max, or -1.
+typedef int (*TriPacketKernel)(const TriPacket &p, const Point &O, const Vector &D, int begin, int end, float &t_max);
+
+int tri_packet_scalar(const TriPacket &p, const Point &O, const Vector &D, int begin, int end, float &t_max);
+int tri_packet_sse(const TriPacket &p, const Point &O, const Vector &D, int begin, int end, float &t_max);
+int tri_packet_avx2(const TriPacket &p, const Point &O, const Vector &D, int begin, int end, float &t_max);
+
+// Kernel in use, the widest one the CPU supports unless overridden.
+extern TriPacketKernel tri_packet_intersect;
+extern const char *tri_kernel_name;
+
+// Kernel by name ("scalar", "sse", "avx2"), NULL if unknown or unsupported here.
+TriPacketKernel find_tri_kernel(const char *name);
+bool use_tri_kernel(const char *name);
+
+#endif
@@ -0,0 +1,153 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+
+#include "model.h"
+
+// Hand-built mesh caches with broken BVH links must be rejected, so that Model parses the OBJ
+// again instead of traversing them. Run from any writable directory; files go there.
+
+static const char *OBJ = "cache_test.obj";
+
+// The parts of Model's cache layout (model.cpp) the test writes: a 96 byte header whose last
+// six fields are the section counts, then 16 byte aligned sections.
+static const size_t HEADER_SIZE = 96, COUNTS_AT = 48;
+
+static size_t align16(size_t n)
+{
+    return (n + 15) & ~(size_t)15;
+}
+
+static void pad_to(std::ofstream &out, size_t &at, size_t to)
+{
+    for(; at < to; ++at)
+        out.put(0);
+}
+
+// One face, 8 leaf slots (one real, seven padding) and the given nodes, under the stamp and
+// version of a cache Model wrote itself.
+static bool WriteCache(const std::string &header, const std::vector<BVHNode> &nodes)
+{
+    uint64_t counts[6] = {3, 3, nodes.size(), TRI_PACKET_WIDTH, TRI_PACKET_WIDTH, 1};
+    std::string h = header;
+    memcpy(&h[COUNTS_AT], counts, sizeof(counts));
+
+    Point verts[3] = {Point(0, 0, 0), Point(1, 0, 0), Point(0, 1, 0)};
+    uint32_t indices[3] = {0, 1, 2};
+    std::vector<int> prims(TRI_PACKET_WIDTH, -1);
+    prims[0] = 0;
+    std::vector<char> tris(TRI_PACKET_WIDTH * sizeof(TriAccel), 0), packets(sizeof(TriPacket), 0);
+
+    const char *sections[6] = {(const char *)verts, (const char *)indices, (const char *)nodes.data(), (const char *)prims.data(),
+                               tris.data(), packets.data()};
+    size_t sizes[6] = {sizeof(verts), sizeof(indices), nodes.size() * sizeof(BVHNode), prims.size() * sizeof(int), tris.size(),
+                       packets.size()};
+
+    std::ofstream out((std::string(OBJ) + ".cache").c_str(), std::ios::out | std::ios::binary);
+    out.write(h.data(), h.size());
+    size_t at = HEADER_SIZE;
+    for(int i = 0; i < 6; ++i)
+    {
+        pad_to(out, at, align16(at));
+        out.write(sections[i], sizes[i]);
+        at += sizes[i];
+    }
+    pad_to(out, at, align16(at));
+    out.close();
+    return !out.fail();
+}
+
+static BVHNode Leaf()
+{
+    BVHNode n;
+    n.first = 0;
+    n.count = 1;
+    return n;
+}
+
+static BVHNode Inner(int right)
+{
+    BVHNode n;
+    n.first = right;
+    n.count = 0;
+    return n;
+}
+
+// A spine of inner nodes, each with a leaf on the left, levels inner nodes deep.
+static std::vector<BVHNode> Spine(int levels)
+{
+    std::vector<BVHNode> nodes;
+    for(int i = 0; i < levels; ++i)
+    {
+        nodes.push_back(Inner((int)nodes.size() + 2));
+        nodes.push_back(Leaf());
+    }
+    nodes.push_back(Leaf());
+    return nodes;
+}
+
+// Whether Model took the cache: a rejected one is replaced by the one-node BVH of the OBJ.
+static bool Accepted(const std::vector<BVHNode> &nodes)
+{
+    Model model(OBJ);
+    return model.bvh.nnodes() == (int)nodes.size();
+}
+
+static int failures = 0;
+
+static void Check(const char *name, bool ok)
+{
+    std::cout << (ok ? "ok      " : "FAILED  ") << name << std::endl;
+    failures += !ok;
+}
+
+
+int main()
+{
+    MODELS_DIR = "";
+    mesh_cache = true;
+    {
+        std::ofstream obj(OBJ);
+        obj << "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n";
+    }
+    Model first(OBJ); // writes the cache whose header the fakes reuse
+    std::ifstream in((std::string(OBJ) + ".cache").c_str(), std::ios::binary);
+    std::string header(HEADER_SIZE, 0);
+    if(!in.read(&header[0], HEADER_SIZE))
+    {
+        std::cout << "FAILED  no cache written for " << OBJ << std::endl;
+        return 1;
+    }
+    in.close();
+
+    std::vector<BVHNode> nodes = Spine(BVH_MAX_DEPTH);
+    Check("a tree BVH_MAX_DEPTH deep is accepted", WriteCache(header, nodes) && Accepted(nodes));
+
+    nodes = Spine(BVH_MAX_DEPTH + 1);
+    Check("a tree deeper than BVH_MAX_DEPTH is rejected", WriteCache(header, nodes) && !Accepted(nodes));
+
+    nodes = Spine(10 * BVH_MAX_DEPTH);
+    Check("a much deeper tree is rejected", WriteCache(header, nodes) && !Accepted(nodes));
+
+    // node 2 is both the right child of node 0 and the left child of node 1
+    nodes.clear();
+    nodes.push_back(Inner(2));
+    nodes.push_back(Inner(3));
+    nodes.push_back(Leaf());
+    nodes.push_back(Leaf());
+    Check("a node with two parents is rejected", WriteCache(header, nodes) && !Accepted(nodes));
+
+    // nodes 3 and 4 are not reached from the root
+    nodes = Spine(1);
+    nodes.push_back(Leaf());
+    nodes.push_back(Leaf());
+    Check("an unreachable node is rejected", WriteCache(header, nodes) && !Accepted(nodes));
+
+    std::remove(OBJ);
+    std::remove((std::string(OBJ) + ".cache").c_str());
+    return failures ? 1 : 0;
+}